@@ -0,0 +1,392 @@
+/*
+ * This file is part of udisks-glue.
+ *
+ * © 2011 Fernando Tarlá Cardoso Lemos
+ *
+ * Refer to the LICENSE file for licensing information.
+ *
+ */
+
+#include <sys/wait.h>
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "command.h"
+
+static const struct {
+    const char *name;
+    gsize length;
+} token_info[NUM_COMMAND_TOKENS] = {
+#define TOKEN(name) { name, sizeof(name) - 1 }
+    TOKEN("%device_file"),
+    TOKEN("%mount_point"),
+    TOKEN("%label"),
+    TOKEN("%uuid"),
+    TOKEN("%type"),
+    TOKEN("%object_path")
+#undef TOKEN
+};
+
+// Either a piece of literal text or a token
+typedef struct {
+    int token;
+    const char *literal;
+    gsize length;
+} segment;
+
+// The literal pieces point into text, which is owned by the template
+typedef struct {
+    gchar *text;
+    segment *segments;
+    guint num_segments;
+    gsize literal_length;
+    unsigned int tokens;
+} template;
+
+struct command_ {
+    gchar *line;
+    command_options options;
+    template *templates;
+    guint num_templates;
+    unsigned int tokens;
+    struct {
+        guint runs;
+        guint failures;
+        guint timeouts;
+        gint64 total_time;
+        gint64 max_time;
+        gint64 total_cpu_time;
+        long max_rss;
+    } stats;
+};
+
+#define LITERAL_SEGMENT (-1)
+
+static int find_token(const char *p)
+{
+    for (int i = 0; i < NUM_COMMAND_TOKENS; ++i) {
+        if (!strncmp(p, token_info[i].name, token_info[i].length))
+            return i;
+    }
+    return LITERAL_SEGMENT;
+}
+
+static void add_segment(GArray *segments, int token, const char *literal, gsize length)
+{
+    if (token == LITERAL_SEGMENT && !length)
+        return;
+    segment seg = { token, literal, length };
+    g_array_append_val(segments, seg);
+}
+
+static void compile_template(template *tpl, const char *string)
+{
+    tpl->tokens = 0;
+    tpl->text = g_strdup(string);
+    tpl->literal_length = 0;
+
+    GArray *segments = g_array_new(FALSE, FALSE, sizeof(segment));
+    const char *literal = tpl->text;
+    for (const char *p = tpl->text; *p; ) {
+        int token = *p == '%' ? find_token(p) : LITERAL_SEGMENT;
+        if (token == LITERAL_SEGMENT) {
+            ++p;
+            continue;
+        }
+
+        add_segment(segments, LITERAL_SEGMENT, literal, p - literal);
+        tpl->literal_length += p - literal;
+        add_segment(segments, token, NULL, 0);
+        tpl->tokens |= 1u << token;
+
+        p += token_info[token].length;
+        literal = p;
+    }
+    add_segment(segments, LITERAL_SEGMENT, literal, strlen(literal));
+    tpl->literal_length += strlen(literal);
+
+    tpl->num_segments = segments->len;
+    tpl->segments = (segment *)g_array_free(segments, FALSE);
+}
+
+static gchar *render_template(const template *tpl, const command_context *ctx)
+{
+    // Find out how long the result is so that it can be built in one go
+    gsize lengths[NUM_COMMAND_TOKENS];
+    gsize length = tpl->literal_length;
+    for (int i = 0; i < NUM_COMMAND_TOKENS; ++i)
+        lengths[i] = ctx->values[i] ? strlen(ctx->values[i]) : token_info[i].length;
+    for (guint i = 0; i < tpl->num_segments; ++i) {
+        if (tpl->segments[i].token != LITERAL_SEGMENT)
+            length += lengths[tpl->segments[i].token];
+    }
+
+    gchar *res = g_malloc(length + 1);
+    gchar *out = res;
+    for (guint i = 0; i < tpl->num_segments; ++i) {
+        const segment *seg = &tpl->segments[i];
+        if (seg->token == LITERAL_SEGMENT) {
+            memcpy(out, seg->literal, seg->length);
+            out += seg->length;
+        }
+        else {
+            const char *value = ctx->values[seg->token] ? ctx->values[seg->token] : token_info[seg->token].name;
+            memcpy(out, value, lengths[seg->token]);
+            out += lengths[seg->token];
+        }
+    }
+    *out = '\0';
+    return res;
+}
+
+// Values are quoted for the shell when they're substituted, so a token that's
+// already within quotes would get the quotes as part of its value or be split
+// into words; returns the first such token, if any
+static int find_quoted_token(const char *line)
+{
+    char quote = '\0';
+    for (const char *p = line; *p; ++p) {
+        if (quote == '\'') {
+            if (*p == '\'')
+                quote = '\0';
+        }
+        else if (*p == '\\') {
+            if (p[1])
+                ++p;
+        }
+        else if (*p == '"' || *p == '\'') {
+            quote = quote == *p ? '\0' : quote ? quote : *p;
+        }
+        else if (*p == '%' && quote) {
+            int token = find_token(p);
+            if (token != LITERAL_SEGMENT)
+                return token;
+        }
+    }
+    return LITERAL_SEGMENT;
+}
+
+command *command_create(const char *line, const command_options *options)
+{
+    if (options->use_shell) {
+        int token = find_quoted_token(line);
+        if (token != LITERAL_SEGMENT) {
+            g_printerr("Token %s is quoted in command ``%s'', but its value is already quoted for the shell\n",
+                    token_info[token].name, line);
+            return NULL;
+        }
+    }
+
+
+    command *cmd = g_malloc0(sizeof(command));
+    cmd->line = g_strdup(line);
+    cmd->options = *options;
+
+    // The shell gets the whole line, otherwise split the command into
+    // arguments once and compile each of them separately
+    if (options->use_shell) {
+        cmd->num_templates = 1;
+        cmd->templates = g_malloc0(sizeof(template));
+        compile_template(&cmd->templates[0], line);
+    }
+    else {
+        GError *error = NULL;
+        gchar **argv;
+        if (!g_shell_parse_argv(line, NULL, &argv, &error)) {
+            g_printerr("Unable to parse command ``%s'': %s\n", line, error->message);
+            g_error_free(error);
+            command_free(cmd);
+            return NULL;
+        }
+
+        cmd->num_templates = g_strv_length(argv);
+        cmd->templates = g_malloc0(sizeof(template) * cmd->num_templates);
+        for (guint i = 0; i < cmd->num_templates; ++i)
+            compile_template(&cmd->templates[i], argv[i]);
+        g_strfreev(argv);
+    }
+
+    for (guint i = 0; i < cmd->num_templates; ++i)
+        cmd->tokens |= cmd->templates[i].tokens;
+
+    return cmd;
+}
+
+void command_free(command *cmd)
+{
+    for (guint i = 0; i < cmd->num_templates; ++i) {
+        g_free(cmd->templates[i].text);
+        g_free(cmd->templates[i].segments);
+    }
+    g_free(cmd->templates);
+    g_free(cmd->line);
+    g_free(cmd);
+}
+
+const char *command_get_line(command *cmd)
+{
+    return cmd->line;
+}
+
+guint command_get_timeout(command *cmd)
+{
+    return cmd->options.timeout;
+}
+
+guint command_get_batch_window(command *cmd)
+{
+    return cmd->options.batch_window;
+}
+
+int command_uses_token(command *cmd, command_token token)
+{
+    return (cmd->tokens & (1u << token)) ? 1 : 0;
+}
+
+static gchar **shell_argv(gchar *line)
+{
+    static const char *shell = NULL;
+    if (!shell) {
+        shell = getenv("SHELL");
+        if (!shell)
+            shell = "/bin/sh";
+    }
+
+    gchar **argv = g_malloc(sizeof(gchar *) * 4);
+    argv[0] = g_strdup(shell);
+    argv[1] = g_strdup("-c");
+    argv[2] = line;
+    argv[3] = NULL;
+    return argv;
+}
+
+// For the shell, each token becomes the list of the quoted values, so that
+// nothing coming from the device (such as its label) is ever parsed as shell
+// code
+static gchar **expand_shell(command *cmd, const command_context * const *ctxs, guint num_ctxs)
+{
+    command_context joined = { .values = { NULL } };
+    GString *values[NUM_COMMAND_TOKENS] = { NULL };
+    for (int i = 0; i < NUM_COMMAND_TOKENS; ++i) {
+        if (!(cmd->tokens & (1u << i)))
+            continue;
+        for (guint j = 0; j < num_ctxs; ++j) {
+            if (!ctxs[j]->values[i])
+                continue;
+            if (!values[i])
+                values[i] = g_string_new(NULL);
+            else
+                g_string_append_c(values[i], ' ');
+            gchar *quoted = g_shell_quote(ctxs[j]->values[i]);
+            g_string_append(values[i], quoted);
+            g_free(quoted);
+        }
+        if (values[i])
+            joined.values[i] = values[i]->str;
+    }
+
+    gchar **argv = shell_argv(render_template(&cmd->templates[0], &joined));
+    for (int i = 0; i < NUM_COMMAND_TOKENS; ++i) {
+        if (values[i])
+            g_string_free(values[i], TRUE);
+    }
+    return argv;
+}
+
+gchar **command_expand(command *cmd, const command_context *ctx)
+{
+    if (cmd->options.use_shell)
+        return expand_shell(cmd, &ctx, 1);
+
+    gchar **argv = g_malloc(sizeof(gchar *) * (cmd->num_templates + 1));
+    for (guint i = 0; i < cmd->num_templates; ++i)
+        argv[i] = render_template(&cmd->templates[i], ctx);
+    argv[cmd->num_templates] = NULL;
+    return argv;
+}
+
+gchar **command_expand_batch(command *cmd, command_context **ctxs, guint num_ctxs)
+{
+    if (num_ctxs == 1)
+        return command_expand(cmd, ctxs[0]);
+
+    if (cmd->options.use_shell)
+        return expand_shell(cmd, (const command_context * const *)ctxs, num_ctxs);
+
+    // Otherwise, each run of arguments with tokens in them is repeated for
+    // every device, so "notify %device_file %mount_point" becomes
+    // "notify dev1 mnt1 dev2 mnt2"
+    GPtrArray *argv = g_ptr_array_new();
+    for (guint i = 0; i < cmd->num_templates; ) {
+        if (!cmd->templates[i].tokens) {
+            g_ptr_array_add(argv, render_template(&cmd->templates[i], ctxs[0]));
+            ++i;
+            continue;
+        }
+
+        guint end = i;
+        while (end < cmd->num_templates && cmd->templates[end].tokens)
+            ++end;
+        for (guint j = 0; j < num_ctxs; ++j) {
+            for (guint k = i; k < end; ++k)
+                g_ptr_array_add(argv, render_template(&cmd->templates[k], ctxs[j]));
+        }
+        i = end;
+    }
+    g_ptr_array_add(argv, NULL);
+    return (gchar **)g_ptr_array_free(argv, FALSE);
+}
+
+command_context *command_context_copy(const command_context *ctx)
+{
+    command_context *copy = g_malloc(sizeof(command_context));
+    for (int i = 0; i < NUM_COMMAND_TOKENS; ++i)
+        copy->values[i] = g_strdup(ctx->values[i]);
+    copy->environment = g_strdupv(ctx->environment);
+    return copy;
+}
+
+void command_context_free(command_context *ctx)
+{
+    for (int i = 0; i < NUM_COMMAND_TOKENS; ++i)
+        g_free((gchar *)ctx->values[i]);
+    g_strfreev(ctx->environment);
+    g_free(ctx);
+}
+
+static gint64 timeval_to_us(const struct timeval *tv)
+{
+    return (gint64)tv->tv_sec * G_USEC_PER_SEC + tv->tv_usec;
+}
+
+void command_record(command *cmd, const process_result *res)
+{
+    gint64 time = res->end_time - res->start_time;
+    gint64 cpu_time = timeval_to_us(&res->usage.ru_utime) + timeval_to_us(&res->usage.ru_stime);
+
+    ++cmd->stats.runs;
+    if (res->timed_out)
+        ++cmd->stats.timeouts;
+    else if (!WIFEXITED(res->status) || WEXITSTATUS(res->status))
+        ++cmd->stats.failures;
+    cmd->stats.total_time += time;
+    if (time > cmd->stats.max_time)
+        cmd->stats.max_time = time;
+    cmd->stats.total_cpu_time += cpu_time;
+    if (res->usage.ru_maxrss > cmd->stats.max_rss)
+        cmd->stats.max_rss = res->usage.ru_maxrss;
+}
+
+void command_log_stats(command *cmd, const char *name)
+{
+    if (!cmd->stats.runs)
+        return;
+
+    g_print("%s: %u runs, %u failed, %u timed out, %.1f ms average, %.1f ms max, %.1f ms CPU average, %ld KiB max RSS\n",
+            name, cmd->stats.runs, cmd->stats.failures, cmd->stats.timeouts,
+            cmd->stats.total_time / 1000.0 / cmd->stats.runs,
+            cmd->stats.max_time / 1000.0,
+            cmd->stats.total_cpu_time / 1000.0 / cmd->stats.runs,
+            cmd->stats.max_rss);
+}
@@ -0,0 +1,60 @@
+/*
+ * This file is part of udisks-glue.
+ *
+ * © 2011 Fernando Tarlá Cardoso Lemos
+ *
+ * Refer to the LICENSE file for licensing information.
+ *
+ */
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <glib.h>
+
+#include "process.h"
+
+typedef struct command_ command;
+
+typedef enum {
+    COMMAND_TOKEN_DEVICE_FILE,
+    COMMAND_TOKEN_MOUNT_POINT,
+    COMMAND_TOKEN_LABEL,
+    COMMAND_TOKEN_UUID,
+    COMMAND_TOKEN_TYPE,
+    COMMAND_TOKEN_OBJECT_PATH,
+    NUM_COMMAND_TOKENS
+} command_token;
+
+// The values the tokens of a command are replaced with; tokens without a
+// value are left alone. The command runs with our environment unless
+// environment is set.
+typedef struct {
+    const char *values[NUM_COMMAND_TOKENS];
+    gchar **environment;
+} command_context;
+
+typedef struct {
+    int use_shell;
+    guint timeout;
+    guint batch_window;
+} command_options;
+
+command *command_create(const char *line, const command_options *options);
+void command_free(command *cmd);
+
+const char *command_get_line(command *cmd);
+guint command_get_timeout(command *cmd);
+guint command_get_batch_window(command *cmd);
+
+int command_uses_token(command *cmd, command_token token);
+gchar **command_expand(command *cmd, const command_context *ctx);
+gchar **command_expand_batch(command *cmd, command_context **ctxs, guint num_ctxs);
+
+command_context *command_context_copy(const command_context *ctx);
+void command_context_free(command_context *ctx);
+
+void command_record(command *cmd, const process_result *res);
+void command_log_stats(command *cmd, const char *name);
+
+#endif
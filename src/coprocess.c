@@ -0,0 +1,190 @@
+/*
+ * This file is part of udisks-glue.
+ *
+ * © 2011 Fernando Tarlá Cardoso Lemos
+ *
+ * Refer to the LICENSE file for licensing information.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coprocess.h"
+#include "process.h"
+
+// Records that don't fit in the buffer are dropped, we never wait for the
+// coprocess
+#define COPROCESS_MAX_BUFFER (256 * 1024)
+
+// Minimum number of seconds between two starts of the coprocess
+#define COPROCESS_RESTART_DELAY 1
+
+struct coprocess_ {
+    gchar *line;
+    int running;
+    int fd;
+    guint write_watch;
+    guint restart_source;
+    gint64 last_start;
+    GString *buffer;
+    guint dropped;
+};
+
+coprocess *coprocess_create(const char *line)
+{
+    coprocess *cp = g_malloc0(sizeof(coprocess));
+    cp->line = g_strdup(line);
+    cp->fd = -1;
+    cp->buffer = g_string_new(NULL);
+    return cp;
+}
+
+static void close_pipe(coprocess *cp)
+{
+    if (cp->write_watch) {
+        g_source_remove(cp->write_watch);
+        cp->write_watch = 0;
+    }
+    if (cp->fd != -1) {
+        close(cp->fd);
+        cp->fd = -1;
+    }
+}
+
+void coprocess_free(coprocess *cp)
+{
+    // Closing the pipe tells the coprocess to exit
+    close_pipe(cp);
+    if (cp->restart_source)
+        g_source_remove(cp->restart_source);
+    g_string_free(cp->buffer, TRUE);
+    g_free(cp->line);
+    g_free(cp);
+}
+
+static void start(coprocess *cp);
+static void flush(coprocess *cp);
+
+static gboolean restart_timeout(gpointer user_data)
+{
+    coprocess *cp = user_data;
+    cp->restart_source = 0;
+    start(cp);
+    return FALSE;
+}
+
+static void ensure_started(coprocess *cp)
+{
+    if (cp->running || cp->restart_source)
+        return;
+
+    // Don't spin if the coprocess dies right away
+    gint64 elapsed = g_get_monotonic_time() - cp->last_start;
+    if (cp->last_start && elapsed < COPROCESS_RESTART_DELAY * G_USEC_PER_SEC)
+        cp->restart_source = g_timeout_add_seconds(COPROCESS_RESTART_DELAY, &restart_timeout, cp);
+    else
+        start(cp);
+}
+
+static void coprocess_exited(const process_result *res, void *user_data)
+{
+    coprocess *cp = user_data;
+    cp->running = 0;
+    close_pipe(cp);
+    g_printerr("Coprocess ``%s'' exited\n", cp->line);
+
+    // Whatever it didn't read is lost, but later records will start it again
+    g_string_truncate(cp->buffer, 0);
+}
+
+static void start(coprocess *cp)
+{
+    cp->last_start = g_get_monotonic_time();
+
+    GError *error = NULL;
+    int fds[2];
+    if (!g_unix_open_pipe(fds, FD_CLOEXEC, &error)) {
+        g_printerr("Unable to create a pipe for coprocess ``%s'': %s\n", cp->line, error->message);
+        g_error_free(error);
+        return;
+    }
+
+    const char *shell = getenv("SHELL");
+    gchar *argv[] = { (gchar *)(shell ? shell : "/bin/sh"), "-c", cp->line, NULL };
+    int res = process_spawn(argv, NULL, 0, fds[0], &coprocess_exited, cp);
+    close(fds[0]);
+    if (!res) {
+        close(fds[1]);
+        return;
+    }
+
+    g_print("Started coprocess ``%s''\n", cp->line);
+    g_unix_set_fd_nonblocking(fds[1], TRUE, NULL);
+    cp->fd = fds[1];
+    cp->running = 1;
+    flush(cp);
+}
+
+static gboolean pipe_writable(GIOChannel *source, GIOCondition condition, gpointer user_data)
+{
+    coprocess *cp = user_data;
+    cp->write_watch = 0;
+    flush(cp);
+    return FALSE;
+}
+
+static void flush(coprocess *cp)
+{
+    while (cp->buffer->len) {
+        ssize_t res = write(cp->fd, cp->buffer->str, cp->buffer->len);
+        if (res > 0) {
+            g_string_erase(cp->buffer, 0, res);
+            continue;
+        }
+        if (res == -1 && errno == EINTR)
+            continue;
+
+        // The coprocess is busy, try again once it has caught up
+        if (res == -1 && errno == EAGAIN) {
+            if (!cp->write_watch) {
+                GIOChannel *channel = g_io_channel_unix_new(cp->fd);
+                cp->write_watch = g_io_add_watch(channel, G_IO_OUT | G_IO_ERR | G_IO_HUP, &pipe_writable, cp);
+                g_io_channel_unref(channel);
+            }
+            return;
+        }
+
+        // It's going away, we'll hear about it from its exit status
+        g_string_truncate(cp->buffer, 0);
+        close_pipe(cp);
+        return;
+    }
+
+    if (cp->dropped) {
+        g_printerr("Coprocess ``%s'' caught up, %u records were dropped\n", cp->line, cp->dropped);
+        cp->dropped = 0;
+    }
+}
+
+void coprocess_send(coprocess *cp, const char *record)
+{
+    gsize length = strlen(record);
+    if (cp->buffer->len + length + 1 > COPROCESS_MAX_BUFFER) {
+        if (!cp->dropped++)
+            g_printerr("Coprocess ``%s'' is stalled, dropping records\n", cp->line);
+        return;
+    }
+
+    g_string_append_len(cp->buffer, record, length);
+    g_string_append_c(cp->buffer, '\n');
+
+    ensure_started(cp);
+    if (cp->fd != -1 && !cp->write_watch)
+        flush(cp);
+}
@@ -0,0 +1,20 @@
+/*
+ * This file is part of udisks-glue.
+ *
+ * © 2011 Fernando Tarlá Cardoso Lemos
+ *
+ * Refer to the LICENSE file for licensing information.
+ *
+ */
+
+#ifndef COPROCESS_H
+#define COPROCESS_H
+
+typedef struct coprocess_ coprocess;
+
+coprocess *coprocess_create(const char *line);
+void coprocess_free(coprocess *cp);
+
+void coprocess_send(coprocess *cp, const char *record);
+
+#endif
@@ -10,10 +10,8 @@
 #include <dbus/dbus-glib.h>
 #include <assert.h>
 #include <glib.h>
-#include <stdlib.h>
 #include <string.h>
 
-#include "dbus_constants.h"
 #include "filter.h"
 #include "property_cache.h"
 #include "props.h"
@@ -22,11 +20,29 @@ typedef struct {
     enum {
         RESTRICTION_TYPE_BOOL,
         RESTRICTION_TYPE_STRING,
+        RESTRICTION_TYPE_GLOB,
+        RESTRICTION_TYPE_REGEX,
         RESTRICTION_TYPE_CUSTOM
     } type;
     union {
-        int bool_value;
-        gchar *string_value;
+        struct {
+            bool_property property;
+            int value;
+        } bool_;
+        struct {
+            string_property property;
+            gchar *value;
+        } string;
+        struct {
+            string_property property;
+            gchar *pattern;
+            GPatternSpec *spec;
+        } glob;
+        struct {
+            string_property property;
+            gchar *pattern;
+            GRegex *regex;
+        } regex;
         struct {
             custom_filter match_func;
             GDestroyNotify free_func;
@@ -34,40 +50,175 @@ typedef struct {
             int value;
         } custom;
     } values;
-    char *property;
+    gchar *description;
+    guint cost;
+    guint evaluations;
+    guint passes;
+    guint index;
+    guint refcount;
 } restriction;
 
 struct filter_ {
     GSList *restrictions;
+    guint index;
 };
 
-static restriction *restriction_create_bool(const char *property, int value)
+// Rough relative cost of evaluating each type of restriction; custom ones
+// usually need several properties, which may have to be fetched
+#define RESTRICTION_COST_BOOL 1
+#define RESTRICTION_COST_STRING 2
+#define RESTRICTION_COST_GLOB 3
+#define RESTRICTION_COST_REGEX 4
+#define RESTRICTION_COST_CUSTOM 4
+
+// Restrictions are reordered according to what they cost and how often they
+// fail every so many evaluations
+#define FILTER_REORDER_INTERVAL 64
+static GSList *all_filters;
+static guint num_evaluations;
+
+// Restrictions are shared by all the filters that use them, so that each of
+// them is evaluated at most once per device, whatever the number of filters
+static GPtrArray *restrictions;
+static guint num_filters;
+
+// Results of the restrictions and filters evaluated so far for a device
+typedef enum {
+    RESULT_UNKNOWN = 0,
+    RESULT_PASS,
+    RESULT_FAIL
+} result;
+
+struct filter_evaluation_ {
+    guint num_restrictions;
+    guint num_filters;
+    guint8 *results;
+};
+
+static int restriction_equal(const restriction *a, const restriction *b)
+{
+    if (a->type != b->type)
+        return 0;
+
+    switch (a->type) {
+        case RESTRICTION_TYPE_BOOL:
+            return a->values.bool_.property.id == b->values.bool_.property.id
+                && a->values.bool_.value == b->values.bool_.value;
+        case RESTRICTION_TYPE_STRING:
+            return a->values.string.property.id == b->values.string.property.id
+                && !strcmp(a->values.string.value, b->values.string.value);
+        case RESTRICTION_TYPE_GLOB:
+            return a->values.glob.property.id == b->values.glob.property.id
+                && !strcmp(a->values.glob.pattern, b->values.glob.pattern);
+        case RESTRICTION_TYPE_REGEX:
+            return a->values.regex.property.id == b->values.regex.property.id
+                && !strcmp(a->values.regex.pattern, b->values.regex.pattern);
+        case RESTRICTION_TYPE_CUSTOM:
+            return a->values.custom.match_func == b->values.custom.match_func
+                && a->values.custom.cookie == b->values.custom.cookie
+                && a->values.custom.value == b->values.custom.value;
+        default:
+            assert(0);
+            return 0;
+    }
+}
+
+static void restriction_free(restriction *r);
+
+static restriction *restriction_intern(restriction *r)
+{
+    if (!restrictions)
+        restrictions = g_ptr_array_new();
+
+    for (guint i = 0; i < restrictions->len; ++i) {
+        restriction *other = restrictions->pdata[i];
+        if (other && restriction_equal(r, other)) {
+            // The cookie of an equal custom restriction is the same one
+            ++other->refcount;
+            if (r->type == RESTRICTION_TYPE_CUSTOM)
+                r->values.custom.free_func = NULL;
+            restriction_free(r);
+            return other;
+        }
+    }
+
+    r->index = restrictions->len;
+    r->refcount = 1;
+    g_ptr_array_add(restrictions, r);
+    return r;
+}
+
+static void restriction_unref(restriction *r)
+{
+    if (--r->refcount)
+        return;
+
+    restrictions->pdata[r->index] = NULL;
+    restriction_free(r);
+}
+
+static restriction *restriction_new(const char *name, const char *value, guint cost)
+{
+    restriction *r = g_malloc0(sizeof(restriction));
+    r->description = g_strdup_printf("%s = %s", name, value);
+    r->cost = cost;
+    return r;
+}
+
+static restriction *restriction_create_bool(const char *name, bool_property property, int value)
 {
-    restriction *r = g_malloc(sizeof(restriction));
+    restriction *r = restriction_new(name, value ? "true" : "false", RESTRICTION_COST_BOOL);
     r->type = RESTRICTION_TYPE_BOOL;
-    r->values.bool_value = value ? BOOL_PROP_TRUE : BOOL_PROP_FALSE;
-    r->property = strdup(property);
+    r->values.bool_.property = property;
+    r->values.bool_.value = value ? BOOL_PROP_TRUE : BOOL_PROP_FALSE;
     return r;
 }
 
-static restriction *restriction_create_string(const char *property, const char *value)
+static restriction *restriction_create_string(const char *name, string_property property, const char *value)
 {
-    restriction *r = g_malloc(sizeof(restriction));
+    restriction *r = restriction_new(name, value, RESTRICTION_COST_STRING);
     r->type = RESTRICTION_TYPE_STRING;
-    r->values.string_value = g_strdup(value);
-    r->property = strdup(property);
+    r->values.string.property = property;
+    r->values.string.value = g_strdup(value);
     return r;
 }
 
-static restriction *restriction_create_custom(custom_filter match_func, GDestroyNotify free_func, void *cookie, int value)
+static restriction *restriction_create_glob(const char *name, string_property property, const char *pattern)
 {
-    restriction *r = g_malloc(sizeof(restriction));
+    restriction *r = restriction_new(name, pattern, RESTRICTION_COST_GLOB);
+    r->type = RESTRICTION_TYPE_GLOB;
+    r->values.glob.property = property;
+    r->values.glob.pattern = g_strdup(pattern);
+    r->values.glob.spec = g_pattern_spec_new(pattern);
+    return r;
+}
+
+static restriction *restriction_create_regex(const char *name, string_property property, const char *pattern)
+{
+    GError *error = NULL;
+    GRegex *regex = g_regex_new(pattern, G_REGEX_OPTIMIZE, 0, &error);
+    if (!regex) {
+        g_printerr("Invalid regular expression for %s: %s\n", name, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    restriction *r = restriction_new(name, pattern, RESTRICTION_COST_REGEX);
+    r->type = RESTRICTION_TYPE_REGEX;
+    r->values.regex.property = property;
+    r->values.regex.pattern = g_strdup(pattern);
+    r->values.regex.regex = regex;
+    return r;
+}
+
+static restriction *restriction_create_custom(const char *name, custom_filter match_func, GDestroyNotify free_func, void *cookie, int value)
+{
+    restriction *r = restriction_new(name, value ? "true" : "false", RESTRICTION_COST_CUSTOM);
     r->type = RESTRICTION_TYPE_CUSTOM;
     r->values.custom.match_func = match_func;
     r->values.custom.free_func = free_func;
     r->values.custom.cookie = cookie;
     r->values.custom.value = value ? BOOL_PROP_TRUE : BOOL_PROP_FALSE;
-    r->property = NULL;
     return r;
 }
 
@@ -77,7 +228,15 @@ static void restriction_free(restriction *r)
         case RESTRICTION_TYPE_BOOL:
             break;
         case RESTRICTION_TYPE_STRING:
-            g_free(r->values.string_value);
+            g_free(r->values.string.value);
+            break;
+        case RESTRICTION_TYPE_GLOB:
+            g_free(r->values.glob.pattern);
+            g_pattern_spec_free(r->values.glob.spec);
+            break;
+        case RESTRICTION_TYPE_REGEX:
+            g_free(r->values.regex.pattern);
+            g_regex_unref(r->values.regex.regex);
             break;
         case RESTRICTION_TYPE_CUSTOM:
             if (r->values.custom.free_func)
@@ -85,8 +244,7 @@ static void restriction_free(restriction *r)
             break;
         default: assert(0); break;
     }
-    if (r->property)
-        free(r->property);
+    g_free(r->description);
     g_free(r);
 }
 
@@ -94,15 +252,24 @@ static int restriction_matches(restriction *r, DBusGProxy *proxy, property_cache
 {
     switch (r->type) {
         case RESTRICTION_TYPE_BOOL: {
-            int value = get_bool_property_cached(cache, proxy, r->property, DBUS_INTERFACE_UDISKS_DEVICE);
-            return value == r->values.bool_value;
+            int value = get_bool_property_cached(cache, proxy, r->values.bool_.property);
+            return value != BOOL_PROP_ERROR && value == r->values.bool_.value;
         }
         case RESTRICTION_TYPE_STRING: {
-            gchar *value = get_string_property_cached(cache, proxy, r->property, DBUS_INTERFACE_UDISKS_DEVICE);
-            return value ? !strcmp(value, r->values.string_value) : 0;
+            gchar *value = get_string_property_cached(cache, proxy, r->values.string.property);
+            return value ? !strcmp(value, r->values.string.value) : 0;
+        }
+        case RESTRICTION_TYPE_GLOB: {
+            gchar *value = get_string_property_cached(cache, proxy, r->values.glob.property);
+            return value ? g_pattern_match_string(r->values.glob.spec, value) : 0;
+        }
+        case RESTRICTION_TYPE_REGEX: {
+            gchar *value = get_string_property_cached(cache, proxy, r->values.regex.property);
+            return value ? g_regex_match(r->values.regex.regex, value, 0, NULL) : 0;
         }
         case RESTRICTION_TYPE_CUSTOM: {
-            return r->values.custom.match_func(proxy, cache, r->values.custom.cookie) == r->values.custom.value;
+            int value = r->values.custom.match_func(proxy, cache, r->values.custom.cookie);
+            return value != BOOL_PROP_ERROR && value == r->values.custom.value;
         }
         default: {
             assert(0);
@@ -113,36 +280,156 @@ static int restriction_matches(restriction *r, DBusGProxy *proxy, property_cache
 
 filter *filter_create(void)
 {
-    return g_malloc0(sizeof(filter));
+    filter *f = g_malloc0(sizeof(filter));
+    f->index = num_filters++;
+    all_filters = g_slist_prepend(all_filters, f);
+    return f;
 }
 
 void filter_free(filter *f)
 {
-    g_slist_foreach(f->restrictions, (GFunc)restriction_free, NULL);
+    g_slist_foreach(f->restrictions, (GFunc)restriction_unref, NULL);
+    g_slist_free(f->restrictions);
+    all_filters = g_slist_remove(all_filters, f);
     g_free(f);
 }
 
-void filter_add_restriction_bool(filter *f, const char *property, int value)
+void filter_add_restriction_bool(filter *f, const char *name, bool_property property, int value)
 {
-    f->restrictions = g_slist_prepend(f->restrictions, restriction_create_bool(property, value));
+    f->restrictions = g_slist_prepend(f->restrictions, restriction_intern(restriction_create_bool(name, property, value)));
 }
 
-void filter_add_restriction_string(filter *f, const char *property, const char *value)
+void filter_add_restriction_string(filter *f, const char *name, string_property property, const char *value)
 {
-    f->restrictions = g_slist_prepend(f->restrictions, restriction_create_string(property, value));
+    f->restrictions = g_slist_prepend(f->restrictions, restriction_intern(restriction_create_string(name, property, value)));
 }
 
-void filter_add_restriction_custom(filter *f, custom_filter match_func, GDestroyNotify free_func, void *cookie, int value)
+void filter_add_restriction_glob(filter *f, const char *name, string_property property, const char *pattern)
 {
-    f->restrictions = g_slist_prepend(f->restrictions, restriction_create_custom(match_func, free_func, cookie, value));
+    f->restrictions = g_slist_prepend(f->restrictions, restriction_intern(restriction_create_glob(name, property, pattern)));
 }
 
-int filter_matches(filter *f, DBusGProxy *proxy, property_cache *cache)
+int filter_add_restriction_regex(filter *f, const char *name, string_property property, const char *pattern)
+{
+    restriction *r = restriction_create_regex(name, property, pattern);
+    if (!r)
+        return 0;
+    f->restrictions = g_slist_prepend(f->restrictions, restriction_intern(r));
+    return 1;
+}
+
+void filter_add_restriction_custom(filter *f, const char *name, custom_filter match_func, GDestroyNotify free_func, void *cookie, int value)
+{
+    f->restrictions = g_slist_prepend(f->restrictions, restriction_intern(restriction_create_custom(name, match_func, free_func, cookie, value)));
+}
+
+int filter_get_string_equality(filter *f, string_property property, const char **value)
 {
     for (GSList *entry = f->restrictions; entry; entry = g_slist_next(entry)) {
         restriction *r = (restriction *)entry->data;
-        if (!restriction_matches(r, proxy, cache))
-            return 0;
+        if (r->type == RESTRICTION_TYPE_STRING && r->values.string.property.id == property.id) {
+            *value = r->values.string.value;
+            return 1;
+        }
     }
-    return 1;
+    return 0;
+}
+
+// The expected cost of finding out that a filter doesn't match is lowest
+// when the restrictions are sorted by cost divided by their probability of
+// failing, which starts out as 1/2
+static double restriction_score(const restriction *r)
+{
+    double fail_rate = (double)(r->evaluations - r->passes + 1) / (r->evaluations + 2);
+    return r->cost / fail_rate;
+}
+
+static gint compare_restrictions(gconstpointer a, gconstpointer b)
+{
+    double score_a = restriction_score(a);
+    double score_b = restriction_score(b);
+    return score_a < score_b ? -1 : score_a > score_b ? 1 : 0;
+}
+
+static void reorder_filters(void)
+{
+    for (GSList *entry = all_filters; entry; entry = g_slist_next(entry)) {
+        filter *f = entry->data;
+        f->restrictions = g_slist_sort(f->restrictions, &compare_restrictions);
+    }
+}
+
+filter_evaluation *filter_evaluation_create(void)
+{
+    if (num_evaluations++ % FILTER_REORDER_INTERVAL == 0)
+        reorder_filters();
+
+    // Filters and restrictions created later are simply not remembered
+    filter_evaluation *eval = g_malloc(sizeof(filter_evaluation));
+    eval->num_restrictions = restrictions ? restrictions->len : 0;
+    eval->num_filters = num_filters;
+    eval->results = g_malloc0(eval->num_restrictions + eval->num_filters);
+    return eval;
+}
+
+void filter_evaluation_free(filter_evaluation *eval)
+{
+    g_free(eval->results);
+    g_free(eval);
+}
+
+static int evaluate(guint8 *memo, DBusGProxy *proxy, property_cache *cache, restriction *r)
+{
+    if (memo && *memo != RESULT_UNKNOWN)
+        return *memo == RESULT_PASS;
+
+    int res = restriction_matches(r, proxy, cache);
+    ++r->evaluations;
+    if (res)
+        ++r->passes;
+    if (memo)
+        *memo = res ? RESULT_PASS : RESULT_FAIL;
+    return res;
+}
+
+int filter_matches(filter *f, DBusGProxy *proxy, property_cache *cache, filter_evaluation *eval)
+{
+    guint8 *memo = eval && f->index < eval->num_filters ? &eval->results[eval->num_restrictions + f->index] : NULL;
+    if (memo && *memo != RESULT_UNKNOWN)
+        return *memo == RESULT_PASS;
+
+    int res = 1;
+    for (GSList *entry = f->restrictions; entry && res; entry = g_slist_next(entry)) {
+        restriction *r = (restriction *)entry->data;
+        guint8 *r_memo = eval && r->index < eval->num_restrictions ? &eval->results[r->index] : NULL;
+        res = evaluate(r_memo, proxy, cache, r);
+    }
+
+    if (memo)
+        *memo = res ? RESULT_PASS : RESULT_FAIL;
+    return res;
+}
+
+void filter_log_restriction_stats(void)
+{
+    if (!restrictions)
+        return;
+
+    for (guint i = 0; i < restrictions->len; ++i) {
+        restriction *r = restrictions->pdata[i];
+        if (r)
+            g_print("Restriction %s: cost %u, %u evaluations, %u passed\n", r->description, r->cost, r->evaluations, r->passes);
+    }
+}
+
+void filter_log_stats(filter *f, const char *name)
+{
+    GString *order = g_string_new(NULL);
+    for (GSList *entry = f->restrictions; entry; entry = g_slist_next(entry)) {
+        if (order->len)
+            g_string_append(order, ", ");
+        g_string_append(order, ((restriction *)entry->data)->description);
+    }
+    g_print("Filter %s: %s\n", name, order->str);
+    g_string_free(order, TRUE);
 }
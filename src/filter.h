@@ -15,15 +15,29 @@
 #include "property_cache.h"
 
 typedef struct filter_ filter;
+typedef struct filter_evaluation_ filter_evaluation;
 typedef int (*custom_filter)(DBusGProxy *, property_cache *, void *);
 
 filter *filter_create(void);
 void filter_free(filter *f);
 
-void filter_add_restriction_bool(filter *f, const char *property, int value);
-void filter_add_restriction_string(filter *f, const char *property, const char *value);
-void filter_add_restriction_custom(filter *f, custom_filter match_func, GDestroyNotify free_func, void *cookie, int value);
+void filter_add_restriction_bool(filter *f, const char *name, bool_property property, int value);
+void filter_add_restriction_string(filter *f, const char *name, string_property property, const char *value);
+void filter_add_restriction_glob(filter *f, const char *name, string_property property, const char *pattern);
+int filter_add_restriction_regex(filter *f, const char *name, string_property property, const char *pattern);
+void filter_add_restriction_custom(filter *f, const char *name, custom_filter match_func, GDestroyNotify free_func, void *cookie, int value);
 
-int filter_matches(filter *f, DBusGProxy *proxy, property_cache *cache);
+// Returns 1 if the filter requires the property to be exactly *value
+int filter_get_string_equality(filter *f, string_property property, const char **value);
+
+// An evaluation remembers the results for a device across filters; it's
+// optional and only valid as long as the device's properties don't change
+filter_evaluation *filter_evaluation_create(void);
+void filter_evaluation_free(filter_evaluation *eval);
+
+int filter_matches(filter *f, DBusGProxy *proxy, property_cache *cache, filter_evaluation *eval);
+
+void filter_log_restriction_stats(void);
+void filter_log_stats(filter *f, const char *name);
 
 #endif
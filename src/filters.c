@@ -15,7 +15,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "dbus_constants.h"
 #include "filter.h"
 #include "props.h"
 
@@ -23,10 +22,13 @@ typedef struct {
     enum {
         FILTER_OPTION_TYPE_BOOL,
         FILTER_OPTION_TYPE_STRING,
+        FILTER_OPTION_TYPE_GLOB,
+        FILTER_OPTION_TYPE_REGEX,
         FILTER_OPTION_TYPE_CUSTOM
     } type;
     union {
-        const char *property_name;
+        bool_property bool_property;
+        string_property string_property;
         struct {
             custom_filter match_func;
             GDestroyNotify free_func;
@@ -40,7 +42,7 @@ typedef struct {
 static int custom_optical_disc_has_audio_tracks(DBusGProxy *proxy, property_cache *cache, void *cookie)
 {
     int success;
-    uint32_t num_audio_tracks = get_uint32_property_cached(cache, proxy, "OpticalDiscNumAudioTracks", DBUS_INTERFACE_UDISKS_DEVICE, &success);
+    uint32_t num_audio_tracks = get_uint32_property_cached(cache, proxy, UINT32_PROPERTY(OPTICAL_DISC_NUM_AUDIO_TRACKS), &success);
     if (success)
         return num_audio_tracks > 0 ? BOOL_PROP_TRUE : BOOL_PROP_FALSE;
     else
@@ -50,46 +52,63 @@ static int custom_optical_disc_has_audio_tracks(DBusGProxy *proxy, property_cach
 static int custom_optical_disc_has_audio_tracks_only(DBusGProxy *proxy, property_cache *cache, void *cookie)
 {
     int success;
-    uint32_t num_tracks = get_uint32_property_cached(cache, proxy, "OpticalDiscNumTracks", DBUS_INTERFACE_UDISKS_DEVICE, &success);
+    uint32_t num_tracks = get_uint32_property_cached(cache, proxy, UINT32_PROPERTY(OPTICAL_DISC_NUM_TRACKS), &success);
     if (!success)
         return BOOL_PROP_ERROR;
-    uint32_t num_audio_tracks = get_uint32_property_cached(cache, proxy, "OpticalDiscNumAudioTracks", DBUS_INTERFACE_UDISKS_DEVICE, &success);
+    uint32_t num_audio_tracks = get_uint32_property_cached(cache, proxy, UINT32_PROPERTY(OPTICAL_DISC_NUM_AUDIO_TRACKS), &success);
     if (!success)
         return BOOL_PROP_ERROR;
     return num_tracks > 0 && num_tracks == num_audio_tracks ? BOOL_PROP_TRUE : BOOL_PROP_FALSE;
 }
 
 #define FILTER_OPTION_BOOL(property, config) \
-    { FILTER_OPTION_TYPE_BOOL, { property }, config, CFG_BOOL(config, cfg_false, CFGF_NODEFAULT) }
+    { FILTER_OPTION_TYPE_BOOL, { .bool_property = { PROPERTY_ID_CHECKED(property, bool) } }, config, CFG_BOOL(config, cfg_false, CFGF_NODEFAULT) }
 
 #define FILTER_OPTION_STRING(property, config) \
-    { FILTER_OPTION_TYPE_STRING, { property }, config, CFG_STR(config, NULL, CFGF_NODEFAULT) }
+    { FILTER_OPTION_TYPE_STRING, { .string_property = { PROPERTY_ID_CHECKED(property, string) } }, config, CFG_STR(config, NULL, CFGF_NODEFAULT) }
+
+// Patterns are compiled once, when the configuration is loaded
+#define FILTER_OPTION_GLOB(property, config) \
+    { FILTER_OPTION_TYPE_GLOB, { .string_property = { PROPERTY_ID_CHECKED(property, string) } }, config, CFG_STR(config, NULL, CFGF_NODEFAULT) }
+
+#define FILTER_OPTION_REGEX(property, config) \
+    { FILTER_OPTION_TYPE_REGEX, { .string_property = { PROPERTY_ID_CHECKED(property, string) } }, config, CFG_STR(config, NULL, CFGF_NODEFAULT) }
 
 #define FILTER_OPTION_CUSTOM(match_func, free_func, cookie, config) \
     { FILTER_OPTION_TYPE_CUSTOM, { .custom = { match_func, free_func, cookie } }, config, CFG_BOOL(config, cfg_false, CFGF_NODEFAULT) }
 
-#define NUM_FILTER_OPTIONS 12
+#define NUM_FILTER_OPTIONS 20
 static filter_option filter_options[NUM_FILTER_OPTIONS] = {
-    FILTER_OPTION_BOOL("DeviceIsRemovable", "removable"),
-    FILTER_OPTION_BOOL("DeviceIsReadOnly", "read_only"),
-    FILTER_OPTION_BOOL("DeviceIsPartition", "partition"),
-    FILTER_OPTION_BOOL("DeviceIsPartitionTable", "partition_table"),
-    FILTER_OPTION_BOOL("DeviceIsOpticalDisc", "optical"),
-    FILTER_OPTION_BOOL("OpticalDiscIsClosed", "optical_disc_closed"),
-    FILTER_OPTION_STRING("IdUsage", "usage"),
-    FILTER_OPTION_STRING("IdType", "type"),
-    FILTER_OPTION_STRING("IdUuid", "uuid"),
-    FILTER_OPTION_STRING("IdLabel", "label"),
+    FILTER_OPTION_BOOL(DEVICE_IS_REMOVABLE, "removable"),
+    FILTER_OPTION_BOOL(DEVICE_IS_READ_ONLY, "read_only"),
+    FILTER_OPTION_BOOL(DEVICE_IS_PARTITION, "partition"),
+    FILTER_OPTION_BOOL(DEVICE_IS_PARTITION_TABLE, "partition_table"),
+    FILTER_OPTION_BOOL(DEVICE_IS_OPTICAL_DISC, "optical"),
+    FILTER_OPTION_BOOL(OPTICAL_DISC_IS_CLOSED, "optical_disc_closed"),
+    FILTER_OPTION_STRING(ID_USAGE, "usage"),
+    FILTER_OPTION_STRING(ID_TYPE, "type"),
+    FILTER_OPTION_STRING(ID_UUID, "uuid"),
+    FILTER_OPTION_STRING(ID_LABEL, "label"),
+    FILTER_OPTION_GLOB(ID_USAGE, "usage_glob"),
+    FILTER_OPTION_GLOB(ID_TYPE, "type_glob"),
+    FILTER_OPTION_GLOB(ID_UUID, "uuid_glob"),
+    FILTER_OPTION_GLOB(ID_LABEL, "label_glob"),
+    FILTER_OPTION_REGEX(ID_USAGE, "usage_regex"),
+    FILTER_OPTION_REGEX(ID_TYPE, "type_regex"),
+    FILTER_OPTION_REGEX(ID_UUID, "uuid_regex"),
+    FILTER_OPTION_REGEX(ID_LABEL, "label_regex"),
     FILTER_OPTION_CUSTOM(&custom_optical_disc_has_audio_tracks, NULL, NULL, "optical_disc_has_audio_tracks"),
     FILTER_OPTION_CUSTOM(&custom_optical_disc_has_audio_tracks_only, NULL, NULL, "optical_disc_has_audio_tracks_only")
 };
 
 #undef FILTER_OPTION_BOOL
 #undef FILTER_OPTION_STRING
+#undef FILTER_OPTION_GLOB
+#undef FILTER_OPTION_REGEX
 
 static GHashTable *filters;
 
-static void add_filter_restrictions(filter *f, cfg_t *sec)
+static int add_filter_restrictions(filter *f, cfg_t *sec)
 {
     for (int i = 0; i < NUM_FILTER_OPTIONS; ++i) {
         filter_option *opt = &filter_options[i];
@@ -97,17 +116,28 @@ static void add_filter_restrictions(filter *f, cfg_t *sec)
             switch (opt->type) {
                 case FILTER_OPTION_TYPE_BOOL: {
                     int value = cfg_getbool(sec, opt->config_name) == cfg_true ? 1 : 0;
-                    filter_add_restriction_bool(f, opt->data.property_name, value);
+                    filter_add_restriction_bool(f, opt->config_name, opt->data.bool_property, value);
                     break;
                 }
                 case FILTER_OPTION_TYPE_STRING: {
                     const char *value = cfg_getstr(sec, opt->config_name);
-                    filter_add_restriction_string(f, opt->data.property_name, value);
+                    filter_add_restriction_string(f, opt->config_name, opt->data.string_property, value);
+                    break;
+                }
+                case FILTER_OPTION_TYPE_GLOB: {
+                    const char *value = cfg_getstr(sec, opt->config_name);
+                    filter_add_restriction_glob(f, opt->config_name, opt->data.string_property, value);
+                    break;
+                }
+                case FILTER_OPTION_TYPE_REGEX: {
+                    const char *value = cfg_getstr(sec, opt->config_name);
+                    if (!filter_add_restriction_regex(f, opt->config_name, opt->data.string_property, value))
+                        return 0;
                     break;
                 }
                 case FILTER_OPTION_TYPE_CUSTOM: {
                     intptr_t value = cfg_getbool(sec, opt->config_name) == cfg_true ? 1 : 0;
-                    filter_add_restriction_custom(f, opt->data.custom.match_func,
+                    filter_add_restriction_custom(f, opt->config_name, opt->data.custom.match_func,
                             opt->data.custom.free_func, opt->data.custom.cookie, value);
                     break;
                 }
@@ -117,6 +147,7 @@ static void add_filter_restrictions(filter *f, cfg_t *sec)
             }
         }
     }
+    return 1;
 }
 
 int filters_init(cfg_t *cfg)
@@ -127,8 +158,11 @@ int filters_init(cfg_t *cfg)
     while (index--) {
         cfg_t *sec = cfg_getnsec(cfg, "filter", index);
         filter *f = filter_create();
-        add_filter_restrictions(f, sec);
         g_hash_table_insert(filters, g_strdup(cfg_title(sec)), f);
+        if (!add_filter_restrictions(f, sec)) {
+            g_printerr("Invalid filter: %s\n", cfg_title(sec));
+            return 0;
+        }
     }
     return 1;
 }
@@ -139,6 +173,18 @@ void filters_free(void)
         g_hash_table_destroy(filters);
 }
 
+static void log_filter_stats(gpointer key, gpointer value, gpointer user_data)
+{
+    filter_log_stats(value, key);
+}
+
+void filters_log_stats(void)
+{
+    filter_log_restriction_stats();
+    if (filters)
+        g_hash_table_foreach(filters, &log_filter_stats, NULL);
+}
+
 filter *filters_find_filter_by_name(const char *name)
 {
     return g_hash_table_lookup(filters, name);
@@ -16,6 +16,7 @@
 
 int filters_init(cfg_t *cfg);
 void filters_free(void);
+void filters_log_stats(void);
 
 cfg_opt_t *filters_get_cfg_opts(void);
 void filters_free_cfg_opts(cfg_opt_t *opts);
@@ -9,28 +9,219 @@
  */
 
 #include <dbus/dbus-glib.h>
+#include <confuse.h>
 #include <glib.h>
 
+#include "command.h"
+#include "coprocess.h"
 #include "dbus_constants.h"
+#include "globals.h"
 #include "handlers.h"
+#include "hooks.h"
+#include "plugins.h"
 #include "props.h"
+#include "proxy_pool.h"
 #include "tracked_object.h"
-#include "util.h"
+
+#define STARTUP_CHUNK_SIZE 16
+#define COALESCE_MAX_WINDOWS 4
+
+typedef struct {
+    gchar *object_path;
+    guint source;
+    gint64 first_seen;
+} pending_change;
+
+// Lower values are handled first
+typedef enum {
+    EVENT_PRIORITY_REMOVAL = 0,
+    EVENT_PRIORITY_CHANGE,
+    EVENT_PRIORITY_INSERTION,
+    NUM_EVENT_PRIORITIES
+} event_priority;
+
+typedef struct {
+    enum {
+        EVENT_TYPE_ADDED,
+        EVENT_TYPE_CHANGED
+    } type;
+    event_priority priority;
+    tracked_object *tobj;
+    int success;
+} queued_event;
 
 static GHashTable *tracked_objects;
 
-static void post_insertion_procedure(tracked_object *tobj)
+static GQueue event_queues[NUM_EVENT_PRIORITIES];
+static GHashTable *queued_events;
+static guint event_source;
+
+static guint coalesce_window;
+static GHashTable *pending_changes;
+
+static coprocess *global_coprocess;
+
+static const char *property_variables[NUM_PROPERTIES] = {
+#define X(id, name, type, scope) "UDISKS_GLUE_" #id,
+    PROPERTY_TABLE(X)
+#undef X
+};
+static GArray *exported_properties;
+
+static DBusGProxy *udisks_proxy;
+static DBusGProxyCall *enumerate_call;
+static GPtrArray *startup_devices;
+static guint startup_num_devices;
+static guint startup_index;
+static guint startup_source;
+static GHashTable *startup_pending;
+static gint64 startup_time;
+
+// Set if the main loop was quit because the daemon can't do its job
+static int failed;
+
+static guint reconcile_source;
+static DBusGProxyCall *reconcile_call;
+static GHashTable *ignored_objects;
+
+static void track_device(const char *object_path);
+static void added_procedure(tracked_object *tobj, int success, int at_startup);
+static void changed_procedure(tracked_object *tobj);
+static void device_changed_refresh_done(tracked_object *tobj, int success, void *user_data);
+
+static gchar **build_environment(tracked_object *tobj)
+{
+    if (!exported_properties)
+        return NULL;
+
+    // Only use what the refreshes loaded, it's usually everything
+    property_cache *cache = tracked_object_get_property_cache(tobj);
+    gchar **environment = g_get_environ();
+    for (guint i = 0; i < exported_properties->len; ++i) {
+        property_id id = g_array_index(exported_properties, property_id, i);
+        gchar *value = NULL;
+        switch (property_get_type(id)) {
+            case PROPERTY_TYPE_bool: {
+                int v;
+                if (property_cache_peek_bool(cache, (bool_property){ id }, &v))
+                    value = g_strdup(v ? "1" : "0");
+                break;
+            }
+            case PROPERTY_TYPE_uint32: {
+                uint32_t v;
+                if (property_cache_peek_uint32(cache, (uint32_property){ id }, &v))
+                    value = g_strdup_printf("%u", v);
+                break;
+            }
+            case PROPERTY_TYPE_string: {
+                const char *v;
+                if (property_cache_peek_string(cache, (string_property){ id }, &v))
+                    value = g_strdup(v);
+                break;
+            }
+            case PROPERTY_TYPE_stringv: {
+                const char * const *v;
+                if (property_cache_peek_stringv(cache, (stringv_property){ id }, &v))
+                    value = g_strjoinv("\n", (gchar **)v);
+                break;
+            }
+        }
+        if (value) {
+            environment = g_environ_setenv(environment, property_variables[id], value, TRUE);
+            g_free(value);
+        }
+    }
+    return environment;
+}
+
+static void run_hook(tracked_object *tobj, command *cmd, const char *mount_point)
+{
+    if (!cmd)
+        return;
+
+    command_context ctx = { .values = {
+        [COMMAND_TOKEN_DEVICE_FILE] = tracked_object_get_device_file(tobj),
+        [COMMAND_TOKEN_MOUNT_POINT] = mount_point,
+        [COMMAND_TOKEN_OBJECT_PATH] = tracked_object_get_object_path(tobj)
+    } };
+
+    // Only look up the properties the command actually uses
+    static const struct {
+        command_token token;
+        property_id id;
+    } property_tokens[] = {
+        { COMMAND_TOKEN_LABEL, PROPERTY_ID_CHECKED(ID_LABEL, string) },
+        { COMMAND_TOKEN_UUID, PROPERTY_ID_CHECKED(ID_UUID, string) },
+        { COMMAND_TOKEN_TYPE, PROPERTY_ID_CHECKED(ID_TYPE, string) }
+    };
+    for (int i = 0; i < G_N_ELEMENTS(property_tokens); ++i) {
+        if (command_uses_token(cmd, property_tokens[i].token)) {
+            string_property property = { property_tokens[i].id };
+            const char *value = tracked_object_get_string_property(tobj, property);
+            ctx.values[property_tokens[i].token] = value ? value : "";
+        }
+    }
+
+    ctx.environment = build_environment(tobj);
+    hooks_run(tracked_object_get_object_path(tobj), cmd, &ctx);
+    g_strfreev(ctx.environment);
+}
+
+static void append_field(GString *record, const char *key, const char *value)
+{
+    if (!value)
+        return;
+
+    // Fields are separated by spaces, so escape them along with newlines
+    if (record->len)
+        g_string_append_c(record, ' ');
+    g_string_append(record, key);
+    g_string_append_c(record, '=');
+    for (const char *p = value; *p; ++p) {
+        switch (*p) {
+            case '\\': g_string_append(record, "\\\\"); break;
+            case ' ': g_string_append(record, "\\s"); break;
+            case '\t': g_string_append(record, "\\t"); break;
+            case '\n': g_string_append(record, "\\n"); break;
+            default: g_string_append_c(record, *p); break;
+        }
+    }
+}
+
+static void send_record(tracked_object *tobj, const char *event, const char *mount_point)
+{
+    coprocess *cp = tracked_object_get_coprocess(tobj);
+    if (!cp)
+        cp = global_coprocess;
+    if (!cp)
+        return;
+
+    GString *record = g_string_new(NULL);
+    append_field(record, "event", event);
+    append_field(record, "object_path", tracked_object_get_object_path(tobj));
+    append_field(record, "device_file", tracked_object_get_device_file(tobj));
+    append_field(record, "mount_point", mount_point);
+    append_field(record, "label", tracked_object_get_string_property(tobj, STRING_PROPERTY(ID_LABEL)));
+    append_field(record, "uuid", tracked_object_get_string_property(tobj, STRING_PROPERTY(ID_UUID)));
+    append_field(record, "type", tracked_object_get_string_property(tobj, STRING_PROPERTY(ID_TYPE)));
+    coprocess_send(cp, record->str);
+    g_string_free(record, TRUE);
+}
+
+static void notify_insertion(tracked_object *tobj)
 {
     gchar *device_file = tracked_object_get_device_file(tobj);
     g_print("Device file %s inserted\n", device_file);
 
     // Get the post insertion command and run it
-    const char *command = tracked_object_get_post_insertion_command(tobj);
-    if (command && command[0]) {
-        gchar *expanded = str_replace((gchar *)command, "%device_file", device_file);
-        run_command(expanded);
-        g_free(expanded);
-    }
+    plugins_notify(PLUGIN_EVENT_INSERTION, tobj, NULL);
+    send_record(tobj, "insertion", NULL);
+    run_hook(tobj, tracked_object_get_post_insertion_command(tobj), NULL);
+}
+
+static void post_insertion_procedure(tracked_object *tobj)
+{
+    notify_insertion(tobj);
 
     // Try to automount the tracked object
     tracked_object_automount_if_needed(tobj);
@@ -43,14 +234,9 @@ static void post_mount_procedure(tracked_object *tobj)
     g_print("Device file %s mounted at %s\n", device_file, mount_point);
 
     // Run the post-mount command
-    const char *command = tracked_object_get_post_mount_command(tobj);
-    if (command && command[0]) {
-        gchar *expanded_tmp = str_replace((gchar *)command, "%device_file", device_file);
-        gchar *expanded = str_replace(expanded_tmp, "%mount_point", mount_point);
-        g_free(expanded_tmp);
-        run_command(expanded);
-        g_free(expanded);
-    }
+    plugins_notify(PLUGIN_EVENT_MOUNT, tobj, mount_point);
+    send_record(tobj, "mount", mount_point);
+    run_hook(tobj, tracked_object_get_post_mount_command(tobj), mount_point);
 }
 
 static void post_unmount_procedure(tracked_object *tobj)
@@ -60,14 +246,9 @@ static void post_unmount_procedure(tracked_object *tobj)
     g_print("Device file %s unmounted from %s\n", device_file, mount_point);
 
     // Run the post-unmount command
-    const char *command = tracked_object_get_post_unmount_command(tobj);
-    if (command && command[0]) {
-        gchar *expanded_tmp = str_replace((gchar *)command, "%device_file", device_file);
-        gchar *expanded = str_replace(expanded_tmp, "%mount_point", mount_point);
-        g_free(expanded_tmp);
-        run_command(expanded);
-        g_free(expanded);
-    }
+    plugins_notify(PLUGIN_EVENT_UNMOUNT, tobj, mount_point);
+    send_record(tobj, "unmount", mount_point);
+    run_hook(tobj, tracked_object_get_post_unmount_command(tobj), mount_point);
 }
 
 static void post_removal_procedure(tracked_object *tobj)
@@ -76,89 +257,383 @@ static void post_removal_procedure(tracked_object *tobj)
     g_print("Device file %s removed\n", device_file);
 
     // Run the post-removal command
-    const char *command = tracked_object_get_post_removal_command(tobj);
-    if (command && command[0]) {
-        gchar *expanded = str_replace((gchar *)command, "%device_file", device_file);
-        run_command(expanded);
-        g_free(expanded);
+    plugins_notify(PLUGIN_EVENT_REMOVAL, tobj, NULL);
+    send_record(tobj, "removal", NULL);
+    run_hook(tobj, tracked_object_get_post_removal_command(tobj), NULL);
+}
+
+static void check_startup_done(void)
+{
+    if (enumerate_call || startup_source || !startup_pending || g_hash_table_size(startup_pending))
+        return;
+
+    gint64 elapsed = g_get_monotonic_time() - startup_time;
+    g_print("Loaded %u devices in %.1f ms\n", startup_num_devices, elapsed / 1000.0);
+
+    g_hash_table_destroy(startup_pending);
+    startup_pending = NULL;
+}
+
+static void startup_device_done(const char *object_path)
+{
+    if (startup_pending && g_hash_table_remove(startup_pending, object_path))
+        check_startup_done();
+}
+
+static gboolean load_devices_chunk(gpointer user_data)
+{
+    // Only start tracking a few devices at a time so that signals received
+    // in the meantime aren't held back
+    for (int i = 0; i < STARTUP_CHUNK_SIZE && startup_index < startup_devices->len; ++i) {
+        const char *object_path = startup_devices->pdata[startup_index++];
+
+        // Skip devices that were added by a signal in the meantime
+        if (g_hash_table_lookup(tracked_objects, object_path))
+            continue;
+
+        g_hash_table_insert(startup_pending, g_strdup(object_path), GINT_TO_POINTER(1));
+        track_device(object_path);
     }
+
+    if (startup_index < startup_devices->len)
+        return TRUE;
+
+    g_ptr_array_foreach(startup_devices, (GFunc)g_free, NULL);
+    g_ptr_array_free(startup_devices, TRUE);
+    startup_devices = NULL;
+    startup_source = 0;
+
+    check_startup_done();
+    return FALSE;
+}
+
+static void enumerate_devices_notify(DBusGProxy *proxy, DBusGProxyCall *call_id, void *user_data)
+{
+    enumerate_call = NULL;
+
+    // Get the list of devices
+    GError *error = NULL;
+    GPtrArray *devices;
+    gboolean res = dbus_g_proxy_end_call(proxy, call_id, &error,
+            dbus_g_type_get_collection("GPtrArray", DBUS_TYPE_G_OBJECT_PATH),
+            &devices,
+            G_TYPE_INVALID);
+    if (!res) {
+        g_printerr("Unable to enumerate the devices: %s\n", error->message);
+        g_error_free(error);
+        failed = 1;
+        g_main_loop_quit(loop);
+        return;
+    }
+
+    // Start tracking them from the main loop
+    startup_devices = devices;
+    startup_num_devices = devices->len;
+    startup_index = 0;
+    startup_pending = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, NULL);
+    startup_source = g_idle_add(&load_devices_chunk, NULL);
 }
 
 static int load_devices(DBusGProxy *proxy)
 {
-    // Get a list of devices
+    startup_time = g_get_monotonic_time();
+    enumerate_call = dbus_g_proxy_begin_call(proxy, "EnumerateDevices", &enumerate_devices_notify, NULL, NULL,
+            G_TYPE_INVALID);
+    return enumerate_call ? 1 : 0;
+}
+
+static void reconcile_devices_notify(DBusGProxy *proxy, DBusGProxyCall *call_id, void *user_data)
+{
+    reconcile_call = NULL;
+
+    // Get the list of devices
     GError *error = NULL;
     GPtrArray *devices;
-    gboolean res = dbus_g_proxy_call(proxy, "EnumerateDevices", &error,
-            G_TYPE_INVALID,
+    gboolean res = dbus_g_proxy_end_call(proxy, call_id, &error,
             dbus_g_type_get_collection("GPtrArray", DBUS_TYPE_G_OBJECT_PATH),
             &devices,
             G_TYPE_INVALID);
     if (!res) {
         g_printerr("Unable to enumerate the devices: %s\n", error->message);
         g_error_free(error);
-        return 0;
+        return;
     }
 
-    // Run the post insertion procedure on these devices
-    for (int i = 0; i < devices->len; ++i) {
-        char *object_path = devices->pdata[i];
-        device_added_signal_handler(proxy, object_path, NULL);
+    GHashTable *present = g_hash_table_new(&g_str_hash, &g_str_equal);
+    for (guint i = 0; i < devices->len; ++i)
+        g_hash_table_insert(present, devices->pdata[i], GINT_TO_POINTER(1));
+
+    // Devices that are gone without us noticing
+    guint num_removed = 0;
+    GSList *removed = NULL;
+    GHashTableIter iter;
+    gpointer object_path;
+    g_hash_table_iter_init(&iter, tracked_objects);
+    while (g_hash_table_iter_next(&iter, &object_path, NULL)) {
+        if (!g_hash_table_lookup(present, object_path))
+            removed = g_slist_prepend(removed, g_strdup(object_path));
+    }
+    g_hash_table_iter_init(&iter, ignored_objects);
+    while (g_hash_table_iter_next(&iter, &object_path, NULL)) {
+        if (!g_hash_table_lookup(present, object_path))
+            g_hash_table_iter_remove(&iter);
+    }
+    for (GSList *entry = removed; entry; entry = entry->next) {
+        device_removed_signal_handler(NULL, entry->data, NULL);
+        g_free(entry->data);
+        ++num_removed;
+    }
+    g_slist_free(removed);
+
+    // Devices we don't know about yet, and devices whose changes we might
+    // have missed; the refresh only reports the transitions that did happen
+    guint num_added = 0;
+    for (guint i = 0; i < devices->len; ++i) {
+        const char *object_path = devices->pdata[i];
+        tracked_object *tobj = g_hash_table_lookup(tracked_objects, object_path);
+        if (tobj) {
+            tracked_object_refresh(tobj, &device_changed_refresh_done, NULL);
+        }
+        else if (!g_hash_table_lookup(ignored_objects, object_path)) {
+            track_device(object_path);
+            ++num_added;
+        }
     }
 
+    if (num_added || num_removed)
+        g_print("Reconciliation found %u new and %u missing devices\n", num_added, num_removed);
+
+    g_hash_table_destroy(present);
     g_ptr_array_foreach(devices, (GFunc)g_free, NULL);
     g_ptr_array_free(devices, TRUE);
-    return 1;
 }
 
-int handlers_init(DBusGProxy *proxy)
+void handlers_reconcile(void)
+{
+    // The startup enumeration is as good as it gets
+    if (enumerate_call || startup_source || reconcile_call)
+        return;
+
+    reconcile_call = dbus_g_proxy_begin_call(udisks_proxy, "EnumerateDevices", &reconcile_devices_notify, NULL, NULL,
+            G_TYPE_INVALID);
+}
+
+static gboolean reconcile_timeout(gpointer user_data)
+{
+    handlers_reconcile();
+    return TRUE;
+}
+
+static void cancel_queued_event(tracked_object *tobj)
+{
+    queued_event *event = g_hash_table_lookup(queued_events, tobj);
+    if (event) {
+        g_queue_remove(&event_queues[event->priority], event);
+        g_hash_table_remove(queued_events, tobj);
+    }
+}
+
+static void forget_tracked_object(tracked_object *tobj)
+{
+    cancel_queued_event(tobj);
+    tracked_object_free(tobj);
+}
+
+static gboolean dispatch_event(gpointer user_data)
+{
+    // Handle a single event per iteration so that everything the main loop
+    // receives in the meantime gets queued (and sorted) before the next one
+    queued_event *event = NULL;
+    for (int i = 0; i < NUM_EVENT_PRIORITIES && !event; ++i)
+        event = g_queue_pop_head(&event_queues[i]);
+    if (event) {
+        g_hash_table_steal(queued_events, event->tobj);
+        if (event->type == EVENT_TYPE_ADDED) {
+            // The tracked object might be gone once the procedure is done
+            gchar *object_path = g_strdup(tracked_object_get_object_path(event->tobj));
+            int at_startup = startup_pending && g_hash_table_lookup(startup_pending, object_path);
+            added_procedure(event->tobj, event->success, at_startup);
+            startup_device_done(object_path);
+            g_free(object_path);
+        }
+        else {
+            changed_procedure(event->tobj);
+        }
+        g_free(event);
+    }
+
+    for (int i = 0; i < NUM_EVENT_PRIORITIES; ++i) {
+        if (!g_queue_is_empty(&event_queues[i]))
+            return TRUE;
+    }
+    event_source = 0;
+    return FALSE;
+}
+
+static void queue_event(tracked_object *tobj, int type, event_priority priority, int success)
+{
+    // Merge with the event already queued for this object, if any. Both
+    // procedures look at the current state of the device, so one is enough;
+    // the insertion procedure runs the hooks of whatever happened since.
+    queued_event *event = g_hash_table_lookup(queued_events, tobj);
+    if (event) {
+        if (event->type == EVENT_TYPE_CHANGED) {
+            if (priority < event->priority) {
+                g_queue_remove(&event_queues[event->priority], event);
+                event->priority = priority;
+                g_queue_push_tail(&event_queues[priority], event);
+            }
+        }
+        return;
+    }
+
+    event = g_malloc(sizeof(queued_event));
+    event->type = type;
+    event->priority = priority;
+    event->tobj = tobj;
+    event->success = success;
+    g_queue_push_tail(&event_queues[priority], event);
+    g_hash_table_insert(queued_events, tobj, event);
+
+    // Run after the pending D-Bus messages have been dispatched
+    if (!event_source)
+        event_source = g_idle_add(&dispatch_event, NULL);
+}
+
+static void pending_change_free(pending_change *change)
+{
+    if (change->source)
+        g_source_remove(change->source);
+    g_free(change->object_path);
+    g_free(change);
+}
+
+int handlers_failed(void)
+{
+    return failed;
+}
+
+int handlers_init(cfg_t *cfg, DBusGProxy *proxy)
 {
     // Create the list of tracked objects
-    tracked_objects = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, (GDestroyNotify)&tracked_object_free);
+    tracked_objects = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, (GDestroyNotify)&forget_tracked_object);
+
+    // Create the event queues
+    for (int i = 0; i < NUM_EVENT_PRIORITIES; ++i)
+        g_queue_init(&event_queues[i]);
+    queued_events = g_hash_table_new_full(&g_direct_hash, &g_direct_equal, NULL, &g_free);
+
+    // DeviceChanged signals for the same object received within this many
+    // milliseconds of each other are handled only once
+    long window = cfg_getint(cfg, "coalesce_window");
+    coalesce_window = window > 0 ? window : 0;
+    pending_changes = g_hash_table_new_full(&g_str_hash, &g_str_equal, NULL, (GDestroyNotify)&pending_change_free);
+
+    // Events that aren't handled by the coprocess of a match go to this one
+    if (cfg_size(cfg, "coprocess"))
+        global_coprocess = coprocess_create(cfg_getstr(cfg, "coprocess"));
+
+    // Properties that are passed to the commands in their environment
+    int num_exported = cfg_size(cfg, "export_properties");
+    if (num_exported) {
+        exported_properties = g_array_new(FALSE, FALSE, sizeof(property_id));
+        for (int i = 0; i < num_exported; ++i) {
+            const char *name = cfg_getnstr(cfg, "export_properties", i);
+            property_id id;
+            if (!property_find_by_name(name, &id)) {
+                g_printerr("Unknown property: %s\n", name);
+                return 0;
+            }
+            g_array_append_val(exported_properties, id);
+        }
+    }
+
+    // Every so many seconds, make sure we haven't missed any signals
+    ignored_objects = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, NULL);
+    long interval = cfg_getint(cfg, "reconcile_interval");
+    if (interval > 0)
+        reconcile_source = g_timeout_add_seconds(interval, &reconcile_timeout, NULL);
 
     // Load it with the devices that are already present in the system
+    udisks_proxy = g_object_ref(proxy);
     return load_devices(proxy);
 }
 
 void handlers_free(void)
 {
+    if (enumerate_call)
+        dbus_g_proxy_cancel_call(udisks_proxy, enumerate_call);
+    if (startup_source)
+        g_source_remove(startup_source);
+    if (startup_devices) {
+        g_ptr_array_foreach(startup_devices, (GFunc)g_free, NULL);
+        g_ptr_array_free(startup_devices, TRUE);
+    }
+    if (startup_pending)
+        g_hash_table_destroy(startup_pending);
+    if (reconcile_source)
+        g_source_remove(reconcile_source);
+    if (reconcile_call)
+        dbus_g_proxy_cancel_call(udisks_proxy, reconcile_call);
+    if (ignored_objects)
+        g_hash_table_destroy(ignored_objects);
+    if (udisks_proxy)
+        g_object_unref(udisks_proxy);
+    if (pending_changes)
+        g_hash_table_destroy(pending_changes);
     if (tracked_objects)
         g_hash_table_destroy(tracked_objects);
+    if (event_source)
+        g_source_remove(event_source);
+    for (int i = 0; i < NUM_EVENT_PRIORITIES; ++i)
+        g_queue_clear(&event_queues[i]);
+    if (queued_events)
+        g_hash_table_destroy(queued_events);
+
+    if (global_coprocess)
+        coprocess_free(global_coprocess);
+    if (exported_properties)
+        g_array_free(exported_properties, TRUE);
+    proxy_pool_free();
 }
 
-void device_added_signal_handler(DBusGProxy *proxy, const char *object_path, gpointer user_data)
+static void added_procedure(tracked_object *tobj, int success, int at_startup)
 {
-    // Remove this object in case something funny is going on
-    g_hash_table_remove(tracked_objects, object_path);
+    const char *object_path = tracked_object_get_object_path(tobj);
 
-    // Create the tracked object
-    tracked_object *tobj = tracked_object_create(object_path);
-    if (!tobj)
+    // Stop tracking objects whose properties couldn't be loaded
+    if (!success) {
+        g_hash_table_remove(tracked_objects, object_path);
         return;
+    }
 
-    // Skip system internal devices
-    int is_system_internal = tracked_object_get_bool_property(tobj, "DeviceIsSystemInternal", 0);
+    // Skip system internal devices, and don't bother reconciling them
+    int is_system_internal = tracked_object_get_bool_property(tobj, BOOL_PROPERTY(DEVICE_IS_SYSTEM_INTERNAL));
     if (is_system_internal != BOOL_PROP_FALSE) {
-        tracked_object_free(tobj);
+        if (is_system_internal == BOOL_PROP_TRUE)
+            g_hash_table_insert(ignored_objects, g_strdup(object_path), GINT_TO_POINTER(1));
+        g_hash_table_remove(tracked_objects, object_path);
         return;
     }
 
     // Get some properties
-    int is_removable = tracked_object_get_bool_property(tobj, "DeviceIsRemovable", 1);
-    int is_mounted = tracked_object_get_bool_property(tobj, "DeviceIsMounted", 0);
-    int is_media_available = tracked_object_get_bool_property(tobj, "DeviceIsMediaAvailable", 0);
+    int is_removable = tracked_object_get_bool_property(tobj, BOOL_PROPERTY(DEVICE_IS_REMOVABLE));
+    int is_mounted = tracked_object_get_bool_property(tobj, BOOL_PROPERTY(DEVICE_IS_MOUNTED));
+    int is_media_available = tracked_object_get_bool_property(tobj, BOOL_PROPERTY(DEVICE_IS_MEDIA_AVAILABLE));
     if (is_removable == BOOL_PROP_ERROR || is_mounted == BOOL_PROP_ERROR || is_media_available == BOOL_PROP_ERROR) {
-        tracked_object_free(tobj);
+        g_hash_table_remove(tracked_objects, object_path);
         return;
     }
 
-    // Add the tracked object to the list of tracked objects
-    g_hash_table_insert(tracked_objects, g_strdup(object_path), tobj);
-
-    // If loading devices on init and device is already mounted
+    // Devices that are already mounted on init are taken as they are, but
+    // other devices can get mounted before their insertion is handled, in
+    // which case they were inserted and then mounted as far as hooks go
     if (is_mounted) {
         tracked_object_set_status(tobj, TRACKED_OBJECT_STATUS_MOUNTED);
-        tracked_object_get_mount_point(tobj);
+        if (tracked_object_get_mount_point(tobj) && !at_startup) {
+            notify_insertion(tobj);
+            post_mount_procedure(tobj);
+        }
     }
 
     // If it's not a removable device, run the post-insertion procedure directly
@@ -180,15 +655,60 @@ void device_added_signal_handler(DBusGProxy *proxy, const char *object_path, gpo
     }
 }
 
-void device_changed_signal_handler(DBusGProxy *proxy, const char *object_path, gpointer user_data)
+static void device_added_refresh_done(tracked_object *tobj, int success, void *user_data)
 {
-    // Check if we were tracking this device
-    tracked_object *tobj = g_hash_table_lookup(tracked_objects, object_path);
-    if (!tobj) return;
+    // Insertions can wait for removals and unmounts
+    queue_event(tobj, EVENT_TYPE_ADDED, EVENT_PRIORITY_INSERTION, success);
+}
 
+static void track_device(const char *object_path)
+{
+    // Remove this object in case something funny is going on
+    g_hash_table_remove(pending_changes, object_path);
+    g_hash_table_remove(ignored_objects, object_path);
+    g_hash_table_remove(tracked_objects, object_path);
+
+    // Start tracking the object right away so that it can be removed while
+    // its properties are still being loaded
+    tracked_object *tobj = tracked_object_create(object_path);
+    g_hash_table_insert(tracked_objects, g_strdup(object_path), tobj);
+
+    // Continue once the properties are available
+    tracked_object_refresh(tobj, &device_added_refresh_done, NULL);
+}
+
+void device_added_signal_handler(DBusGProxy *proxy, const char *object_path, gpointer user_data)
+{
+    track_device(object_path);
+}
+
+static void device_changed_refresh_done(tracked_object *tobj, int success, void *user_data)
+{
+    if (!success)
+        return;
+
+    // Most DeviceChanged signals are about things we don't care about
+    if (!tracked_object_get_changes(tobj))
+        return;
+
+    // Let unmounts and media removals skip ahead of other changes, since
+    // their hooks are usually the most time-critical
+    event_priority priority = EVENT_PRIORITY_CHANGE;
+    int is_mounted = tracked_object_get_bool_property(tobj, BOOL_PROPERTY(DEVICE_IS_MOUNTED));
+    int is_media_available = tracked_object_get_bool_property(tobj, BOOL_PROPERTY(DEVICE_IS_MEDIA_AVAILABLE));
+    tracked_object_status status = tracked_object_get_status(tobj);
+    if ((status == TRACKED_OBJECT_STATUS_MOUNTED && is_mounted == BOOL_PROP_FALSE)
+            || (status == TRACKED_OBJECT_STATUS_INSERTED && is_media_available == BOOL_PROP_FALSE))
+        priority = EVENT_PRIORITY_REMOVAL;
+
+    queue_event(tobj, EVENT_TYPE_CHANGED, priority, success);
+}
+
+static void changed_procedure(tracked_object *tobj)
+{
     // Get some properties
-    int is_mounted = tracked_object_get_bool_property(tobj, "DeviceIsMounted", 0);
-    int is_media_available = tracked_object_get_bool_property(tobj, "DeviceIsMediaAvailable", 0);
+    int is_mounted = tracked_object_get_bool_property(tobj, BOOL_PROPERTY(DEVICE_IS_MOUNTED));
+    int is_media_available = tracked_object_get_bool_property(tobj, BOOL_PROPERTY(DEVICE_IS_MEDIA_AVAILABLE));
     if (is_mounted == BOOL_PROP_ERROR || is_media_available == BOOL_PROP_ERROR)
         return;
 
@@ -227,8 +747,68 @@ void device_changed_signal_handler(DBusGProxy *proxy, const char *object_path, g
     }
 }
 
+static void handle_device_change(const char *object_path)
+{
+    // Check if we were tracking this device
+    tracked_object *tobj = g_hash_table_lookup(tracked_objects, object_path);
+    if (!tobj) return;
+
+    // Continue once the properties have been reloaded
+    tracked_object_refresh(tobj, &device_changed_refresh_done, NULL);
+}
+
+static gboolean pending_change_expired(gpointer user_data)
+{
+    pending_change *change = user_data;
+
+    // The source is removed when we return
+    change->source = 0;
+
+    gchar *object_path = g_strdup(change->object_path);
+    g_hash_table_remove(pending_changes, object_path);
+    handle_device_change(object_path);
+    g_free(object_path);
+
+    return FALSE;
+}
+
+void device_changed_signal_handler(DBusGProxy *proxy, const char *object_path, gpointer user_data)
+{
+    if (!coalesce_window) {
+        handle_device_change(object_path);
+        return;
+    }
+
+    // Ignore devices we aren't tracking
+    if (!g_hash_table_lookup(tracked_objects, object_path))
+        return;
+
+    // Wait until the signals stop coming, but not forever
+    gint64 now = g_get_monotonic_time();
+    pending_change *change = g_hash_table_lookup(pending_changes, object_path);
+    if (change) {
+        if (now - change->first_seen >= (gint64)coalesce_window * COALESCE_MAX_WINDOWS * 1000)
+            return;
+        g_source_remove(change->source);
+    }
+    else {
+        change = g_malloc(sizeof(pending_change));
+        change->object_path = g_strdup(object_path);
+        change->first_seen = now;
+        g_hash_table_insert(pending_changes, change->object_path, change);
+    }
+    change->source = g_timeout_add(coalesce_window, &pending_change_expired, change);
+}
+
 void device_removed_signal_handler(DBusGProxy *proxy, const char *object_path, gpointer user_data)
 {
+    // Don't wait for devices that are gone during startup
+    startup_device_done(object_path);
+
+    // The removal supersedes any change we haven't handled yet
+    g_hash_table_remove(pending_changes, object_path);
+    g_hash_table_remove(ignored_objects, object_path);
+
     // Check if we were tracking this device
     tracked_object *tobj = g_hash_table_lookup(tracked_objects, object_path);
     if (!tobj) return;
@@ -241,7 +821,11 @@ void device_removed_signal_handler(DBusGProxy *proxy, const char *object_path, g
     }
 
     // Remove the reference to the object from the table to avoid races
+    gpointer key;
+    g_hash_table_lookup_extended(tracked_objects, object_path, &key, NULL);
     g_hash_table_steal(tracked_objects, object_path);
+    cancel_queued_event(tobj);
+    g_free(key);
 
     // If the device was mounted, run the post-unmount procedure
     if (status == TRACKED_OBJECT_STATUS_MOUNTED)
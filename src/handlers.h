@@ -11,9 +11,12 @@
 #define HANDLERS_H
 
 #include <dbus/dbus-glib.h>
+#include <confuse.h>
 
-int handlers_init(DBusGProxy *proxy);
+int handlers_init(cfg_t *cfg, DBusGProxy *proxy);
 void handlers_free(void);
+int handlers_failed(void);
+void handlers_reconcile(void);
 
 void device_added_signal_handler(DBusGProxy *proxy, const char *object_path, gpointer user_data);
 void device_changed_signal_handler(DBusGProxy *proxy, const char *object_path, gpointer user_data);
@@ -0,0 +1,275 @@
+/*
+ * This file is part of udisks-glue.
+ *
+ * © 2011 Fernando Tarlá Cardoso Lemos
+ *
+ * Refer to the LICENSE file for licensing information.
+ *
+ */
+
+#include <sys/wait.h>
+#include <confuse.h>
+#include <glib.h>
+
+#include "command.h"
+#include "hooks.h"
+#include "process.h"
+
+// The hooks of a device run one at a time, in the order they were requested
+typedef struct {
+    gchar *object_path;
+    GQueue jobs;
+    int running;
+} hook_device;
+
+// A job can be about several devices when its command is batched; it's
+// queued for each of them and only runs once it's first in line for all of
+// them. While the batch is being collected, argv is NULL. Batches run with
+// the environment of their first device.
+typedef struct {
+    command *cmd;
+    gchar **argv;
+    gchar **environment;
+    GPtrArray *devices;
+    GPtrArray *contexts;
+    guint batch_source;
+    int ready;
+} hook_job;
+
+static GHashTable *devices;
+static GHashTable *batches;
+static GQueue ready_jobs = G_QUEUE_INIT;
+static guint max_concurrent_hooks;
+static guint num_running;
+
+static void hook_job_free(hook_job *job)
+{
+    if (job->batch_source)
+        g_source_remove(job->batch_source);
+    if (job->contexts) {
+        g_ptr_array_foreach(job->contexts, (GFunc)command_context_free, NULL);
+        g_ptr_array_free(job->contexts, TRUE);
+    }
+    if (job->argv)
+        g_strfreev(job->argv);
+    if (job->environment)
+        g_strfreev(job->environment);
+    g_ptr_array_free(job->devices, TRUE);
+    g_free(job);
+}
+
+static void hook_device_free(hook_device *device)
+{
+    g_queue_clear(&device->jobs);
+    g_free(device->object_path);
+    g_free(device);
+}
+
+int hooks_init(cfg_t *cfg)
+{
+    long max = cfg_getint(cfg, "max_concurrent_hooks");
+    max_concurrent_hooks = max > 0 ? max : 0;
+    devices = g_hash_table_new_full(&g_str_hash, &g_str_equal, NULL, (GDestroyNotify)&hook_device_free);
+    batches = g_hash_table_new(&g_direct_hash, &g_direct_equal);
+    return 1;
+}
+
+static void collect_jobs(gpointer key, gpointer value, gpointer user_data)
+{
+    hook_device *device = value;
+    for (GList *entry = device->jobs.head; entry; entry = entry->next)
+        g_hash_table_insert(user_data, entry->data, entry->data);
+}
+
+void hooks_free(void)
+{
+    g_queue_clear(&ready_jobs);
+    if (batches) {
+        g_hash_table_destroy(batches);
+        batches = NULL;
+    }
+    if (devices) {
+        // Jobs can be queued for several devices, free each of them once
+        GHashTable *jobs = g_hash_table_new_full(&g_direct_hash, &g_direct_equal, NULL, (GDestroyNotify)&hook_job_free);
+        g_hash_table_foreach(devices, &collect_jobs, jobs);
+        g_hash_table_destroy(jobs);
+        g_hash_table_destroy(devices);
+        devices = NULL;
+    }
+}
+
+static void check_ready(hook_job *job)
+{
+    if (job->ready || !job->argv)
+        return;
+
+    for (guint i = 0; i < job->devices->len; ++i) {
+        hook_device *device = job->devices->pdata[i];
+        if (device->running || g_queue_peek_head(&device->jobs) != job)
+            return;
+    }
+
+    job->ready = 1;
+    g_queue_push_tail(&ready_jobs, job);
+}
+
+static void job_finished(hook_job *job)
+{
+    // The job is first in line for all of its devices
+    for (guint i = 0; i < job->devices->len; ++i) {
+        hook_device *device = job->devices->pdata[i];
+        g_queue_pop_head(&device->jobs);
+        device->running = 0;
+    }
+
+    // See what's next for each of them
+    for (guint i = 0; i < job->devices->len; ++i) {
+        hook_device *device = job->devices->pdata[i];
+        if (g_queue_is_empty(&device->jobs))
+            g_hash_table_remove(devices, device->object_path);
+        else
+            check_ready(g_queue_peek_head(&device->jobs));
+    }
+
+    hook_job_free(job);
+}
+
+static void hook_done(const process_result *res, void *user_data);
+
+static void schedule(void)
+{
+    while (!max_concurrent_hooks || num_running < max_concurrent_hooks) {
+        hook_job *job = g_queue_pop_head(&ready_jobs);
+        if (!job)
+            break;
+
+        for (guint i = 0; i < job->devices->len; ++i)
+            ((hook_device *)job->devices->pdata[i])->running = 1;
+        ++num_running;
+
+        // Move on to the next hook if this one couldn't even be started
+        if (!process_spawn(job->argv, job->environment, command_get_timeout(job->cmd), -1, &hook_done, job)) {
+            --num_running;
+            job_finished(job);
+        }
+    }
+}
+
+static void hook_done(const process_result *res, void *user_data)
+{
+    hook_job *job = user_data;
+    command_record(job->cmd, res);
+
+    const char *line = command_get_line(job->cmd);
+    if (res->timed_out)
+        g_printerr("Command ``%s'' timed out after %u seconds\n", line, command_get_timeout(job->cmd));
+    else if (WIFSIGNALED(res->status))
+        g_printerr("Command ``%s'' was killed by signal %d\n", line, WTERMSIG(res->status));
+    else if (WIFEXITED(res->status) && WEXITSTATUS(res->status))
+        g_printerr("Command ``%s'' exited with status %d\n", line, WEXITSTATUS(res->status));
+
+    --num_running;
+    job_finished(job);
+    schedule();
+}
+
+static void close_batch(hook_job *job)
+{
+    g_hash_table_remove(batches, job->cmd);
+    command_context *first = job->contexts->pdata[0];
+    job->argv = command_expand_batch(job->cmd, (command_context **)job->contexts->pdata, job->contexts->len);
+    job->environment = first->environment;
+    first->environment = NULL;
+    g_ptr_array_foreach(job->contexts, (GFunc)command_context_free, NULL);
+    g_ptr_array_free(job->contexts, TRUE);
+    job->contexts = NULL;
+    check_ready(job);
+}
+
+static void end_batch(hook_job *job)
+{
+    g_source_remove(job->batch_source);
+    job->batch_source = 0;
+    close_batch(job);
+}
+
+static gboolean batch_expired(gpointer user_data)
+{
+    hook_job *job = user_data;
+    job->batch_source = 0;
+    close_batch(job);
+    schedule();
+    return FALSE;
+}
+
+static hook_device *get_device(const char *object_path)
+{
+    hook_device *device = g_hash_table_lookup(devices, object_path);
+    if (!device) {
+        device = g_malloc0(sizeof(hook_device));
+        device->object_path = g_strdup(object_path);
+        g_queue_init(&device->jobs);
+        g_hash_table_insert(devices, device->object_path, device);
+    }
+    return device;
+}
+
+static hook_job *create_job(command *cmd)
+{
+    hook_job *job = g_malloc0(sizeof(hook_job));
+    job->cmd = cmd;
+    job->devices = g_ptr_array_new();
+    return job;
+}
+
+// Queuing anything after an open batch closes it, so that open batches are
+// always last in line. The jobs of every device are then queued in the order
+// they were closed, and two batches can never wait for each other.
+static void add_device(hook_job *job, hook_device *device)
+{
+    hook_job *last = g_queue_peek_tail(&device->jobs);
+    if (last && last != job && last->contexts)
+        end_batch(last);
+
+    g_ptr_array_add(job->devices, device);
+    g_queue_push_tail(&device->jobs, job);
+}
+
+void hooks_run(const char *object_path, command *cmd, const command_context *ctx)
+{
+    hook_device *device = get_device(object_path);
+    guint batch_window = command_get_batch_window(cmd);
+    if (!batch_window) {
+        hook_job *job = create_job(cmd);
+        job->argv = command_expand(cmd, ctx);
+        job->environment = g_strdupv(ctx->environment);
+        add_device(job, device);
+        check_ready(job);
+        schedule();
+        return;
+    }
+
+    // A device can only be in a batch once, so the same command for the same
+    // device closes the batch early
+    hook_job *job = g_hash_table_lookup(batches, cmd);
+    if (job) {
+        for (guint i = 0; i < job->devices->len; ++i) {
+            if (job->devices->pdata[i] == device) {
+                end_batch(job);
+                job = NULL;
+                break;
+            }
+        }
+    }
+
+    // Hold the device's place in line while the batch is being collected
+    if (!job) {
+        job = create_job(cmd);
+        job->contexts = g_ptr_array_new();
+        job->batch_source = g_timeout_add(batch_window, &batch_expired, job);
+        g_hash_table_insert(batches, cmd, job);
+    }
+    add_device(job, device);
+    g_ptr_array_add(job->contexts, command_context_copy(ctx));
+    schedule();
+}
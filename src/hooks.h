@@ -0,0 +1,23 @@
+/*
+ * This file is part of udisks-glue.
+ *
+ * © 2011 Fernando Tarlá Cardoso Lemos
+ *
+ * Refer to the LICENSE file for licensing information.
+ *
+ */
+
+#ifndef HOOKS_H
+#define HOOKS_H
+
+#include <confuse.h>
+#include <glib.h>
+
+#include "command.h"
+
+int hooks_init(cfg_t *cfg);
+void hooks_free(void);
+
+void hooks_run(const char *object_path, command *cmd, const command_context *ctx);
+
+#endif
@@ -13,6 +13,7 @@
 #include <confuse.h>
 #include <getopt.h>
 #include <glib.h>
+#include <glib-unix.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,8 +22,11 @@
 #include "dbus_constants.h"
 #include "filters.h"
 #include "handlers.h"
+#include "hooks.h"
 #include "match.h"
 #include "matches.h"
+#include "plugins.h"
+#include "process.h"
 #include "session.h"
 #include "util.h"
 
@@ -39,6 +43,19 @@ static void signal_handler(int sig)
         g_main_loop_quit(loop);
 }
 
+static gboolean reconcile_signal_handler(gpointer user_data)
+{
+    handlers_reconcile();
+    return TRUE;
+}
+
+static gboolean stats_signal_handler(gpointer user_data)
+{
+    matches_log_stats();
+    filters_log_stats();
+    return TRUE;
+}
+
 static void print_usage(FILE *out)
 {
     fprintf(out, "\
@@ -104,6 +121,12 @@ static int parse_config(int argc, char **argv, int *rc)
         CFG_SEC("filter", filter_opts, CFGF_MULTI | CFGF_TITLE),
         CFG_SEC("match", match_opts, CFGF_MULTI | CFGF_TITLE),
         CFG_SEC("default", match_opts, CFGF_NONE),
+        CFG_INT("coalesce_window", 0, CFGF_NONE),
+        CFG_INT("reconcile_interval", 0, CFGF_NONE),
+        CFG_INT("max_concurrent_hooks", 0, CFGF_NONE),
+        CFG_STR_LIST("plugins", NULL, CFGF_NODEFAULT),
+        CFG_STR("coprocess", NULL, CFGF_NODEFAULT),
+        CFG_STR_LIST("export_properties", NULL, CFGF_NODEFAULT),
         CFG_END()
     };
 
@@ -164,6 +187,15 @@ int main(int argc, char **argv)
     if (!matches_init(cfg))
         goto cleanup;
 
+    if (!hooks_init(cfg))
+        goto cleanup;
+
+    if (!process_init())
+        goto cleanup;
+
+    if (!plugins_init(cfg))
+        goto cleanup;
+
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     signal(SIGQUIT, signal_handler);
@@ -186,7 +218,7 @@ int main(int argc, char **argv)
     }
 
     proxy = dbus_g_proxy_new_for_name(dbus_conn, DBUS_COMMON_NAME_UDISKS, DBUS_OBJECT_PATH_UDISKS_ROOT, DBUS_INTERFACE_UDISKS);
-    if (!handlers_init(proxy))
+    if (!handlers_init(cfg, proxy))
         goto cleanup;
 
     dbus_g_proxy_add_signal(proxy, "DeviceAdded", DBUS_TYPE_G_OBJECT_PATH, G_TYPE_INVALID);
@@ -195,9 +227,13 @@ int main(int argc, char **argv)
     dbus_g_proxy_connect_signal(proxy, "DeviceAdded", G_CALLBACK(device_added_signal_handler), NULL, NULL);
     dbus_g_proxy_connect_signal(proxy, "DeviceChanged", G_CALLBACK(device_changed_signal_handler), NULL, NULL);
     dbus_g_proxy_connect_signal(proxy, "DeviceRemoved", G_CALLBACK(device_removed_signal_handler), NULL, NULL);
+    g_unix_signal_add(SIGUSR1, &reconcile_signal_handler, NULL);
+    g_unix_signal_add(SIGUSR2, &stats_signal_handler, NULL);
 
     g_main_loop_run(loop);
-    rc = EXIT_SUCCESS;
+    matches_log_stats();
+    filters_log_stats();
+    rc = handlers_failed() ? EXIT_FAILURE : EXIT_SUCCESS;
 
 cleanup:
     if (cfg) cfg_free(cfg);
@@ -208,6 +244,9 @@ cleanup:
     if (fpidfile) fclose(fpidfile);
     if (enable_session) session_free();
     handlers_free();
+    hooks_free();
+    process_free();
+    plugins_free();
     matches_free();
     filters_free();
     return rc;
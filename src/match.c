@@ -10,23 +10,39 @@
 #include <confuse.h>
 #include <glib.h>
 
+#include "command.h"
+#include "coprocess.h"
 #include "filter.h"
 #include "match.h"
 
 struct match_ {
+    gchar *name;
     filter *filter_obj;
     int automount;
     gchar *automount_filesystem;
     gchar **automount_options;
-    char *post_insertion_command;
-    char *post_mount_command;
-    char *post_unmount_command;
-    char *post_removal_command;
+    command *post_insertion_command;
+    command *post_mount_command;
+    command *post_unmount_command;
+    command *post_removal_command;
+    coprocess *coprocess_obj;
 };
 
+static int load_command(cfg_t *sec, const char *name, const command_options *options, command **cmd)
+{
+    // Empty commands are the same as no command at all
+    const char *line = cfg_size(sec, name) ? cfg_getstr(sec, name) : NULL;
+    if (!line || !line[0])
+        return 1;
+
+    *cmd = command_create(line, options);
+    return *cmd ? 1 : 0;
+}
+
 match *match_create(cfg_t *sec, filter *f)
 {
     match *m = g_malloc0(sizeof(match));
+    m->name = g_strdup(f ? cfg_title(sec) : "default");
     m->filter_obj = f;
 
     m->automount = cfg_getbool(sec, "automount") ? 1 : 0;
@@ -39,14 +55,22 @@ match *match_create(cfg_t *sec, filter *f)
             m->automount_options[i] = g_strdup(cfg_getnstr(sec, "automount_options", i));
     }
 
-    if (cfg_size(sec, "post_insertion_command"))
-        m->post_insertion_command = cfg_getstr(sec, "post_insertion_command");
-    if (cfg_size(sec, "post_mount_command"))
-        m->post_mount_command = cfg_getstr(sec, "post_mount_command");
-    if (cfg_size(sec, "post_unmount_command"))
-        m->post_unmount_command = cfg_getstr(sec, "post_unmount_command");
-    if (cfg_size(sec, "post_removal_command"))
-        m->post_removal_command = cfg_getstr(sec, "post_removal_command");
+    if (cfg_size(sec, "coprocess"))
+        m->coprocess_obj = coprocess_create(cfg_getstr(sec, "coprocess"));
+
+    command_options options;
+    long timeout = cfg_getint(sec, "hook_timeout");
+    long batch_window = cfg_getint(sec, "batch_window");
+    options.use_shell = cfg_getbool(sec, "use_shell") ? 1 : 0;
+    options.timeout = timeout > 0 ? timeout : 0;
+    options.batch_window = batch_window > 0 ? batch_window : 0;
+    if (!load_command(sec, "post_insertion_command", &options, &m->post_insertion_command)
+            || !load_command(sec, "post_mount_command", &options, &m->post_mount_command)
+            || !load_command(sec, "post_unmount_command", &options, &m->post_unmount_command)
+            || !load_command(sec, "post_removal_command", &options, &m->post_removal_command)) {
+        match_free(m);
+        return NULL;
+    }
 
     return m;
 }
@@ -57,6 +81,17 @@ void match_free(match *m)
         g_strfreev(m->automount_options);
     if (m->automount_filesystem)
         g_free(m->automount_filesystem);
+    if (m->post_insertion_command)
+        command_free(m->post_insertion_command);
+    if (m->post_mount_command)
+        command_free(m->post_mount_command);
+    if (m->post_unmount_command)
+        command_free(m->post_unmount_command);
+    if (m->post_removal_command)
+        command_free(m->post_removal_command);
+    if (m->coprocess_obj)
+        coprocess_free(m->coprocess_obj);
+    g_free(m->name);
     g_free(m);
 }
 
@@ -70,6 +105,10 @@ cfg_opt_t *match_get_cfg_opts(void)
         CFG_STR("post_mount_command", NULL, CFGF_NODEFAULT),
         CFG_STR("post_unmount_command", NULL, CFGF_NODEFAULT),
         CFG_STR("post_removal_command", NULL, CFGF_NODEFAULT),
+        CFG_BOOL("use_shell", cfg_true, CFGF_NONE),
+        CFG_INT("hook_timeout", 0, CFGF_NONE),
+        CFG_INT("batch_window", 0, CFGF_NONE),
+        CFG_STR("coprocess", NULL, CFGF_NODEFAULT),
         CFG_END()
     };
     return opts;
@@ -79,31 +118,65 @@ void match_free_cfg_opts(cfg_opt_t *opts)
 {
 }
 
-int match_matches(match *m, DBusGProxy *proxy, property_cache *cache)
+void match_log_stats(match *m)
+{
+    static const char *names[] = {
+        "post_insertion_command",
+        "post_mount_command",
+        "post_unmount_command",
+        "post_removal_command"
+    };
+    command *commands[] = {
+        m->post_insertion_command,
+        m->post_mount_command,
+        m->post_unmount_command,
+        m->post_removal_command
+    };
+
+    for (int i = 0; i < G_N_ELEMENTS(commands); ++i) {
+        if (commands[i]) {
+            gchar *name = g_strdup_printf("%s %s", m->name, names[i]);
+            command_log_stats(commands[i], name);
+            g_free(name);
+        }
+    }
+}
+
+filter *match_get_filter(match *m)
+{
+    return m->filter_obj;
+}
+
+int match_matches(match *m, DBusGProxy *proxy, property_cache *cache, filter_evaluation *eval)
 {
-    return m->filter_obj ? filter_matches(m->filter_obj, proxy, cache) : 1;
+    return m->filter_obj ? filter_matches(m->filter_obj, proxy, cache, eval) : 1;
 }
 
-const char *match_get_post_insertion_command(match *m)
+command *match_get_post_insertion_command(match *m)
 {
     return m->post_insertion_command;
 }
 
-const char *match_get_post_mount_command(match *m)
+command *match_get_post_mount_command(match *m)
 {
     return m->post_mount_command;
 }
 
-const char *match_get_post_unmount_command(match *m)
+command *match_get_post_unmount_command(match *m)
 {
     return m->post_unmount_command;
 }
 
-const char *match_get_post_removal_command(match *m)
+command *match_get_post_removal_command(match *m)
 {
     return m->post_removal_command;
 }
 
+coprocess *match_get_coprocess(match *m)
+{
+    return m->coprocess_obj;
+}
+
 int match_get_automount(match *m)
 {
     return m->automount;
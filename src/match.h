@@ -13,6 +13,8 @@
 #include <dbus/dbus-glib.h>
 #include <confuse.h>
 
+#include "command.h"
+#include "coprocess.h"
 #include "filter.h"
 #include "property_cache.h"
 
@@ -24,15 +26,19 @@ void match_free(match *m);
 cfg_opt_t *match_get_cfg_opts(void);
 void match_free_cfg_opts(cfg_opt_t *opts);
 
-int match_matches(match *m, DBusGProxy *proxy, property_cache *cache);
+filter *match_get_filter(match *m);
+int match_matches(match *m, DBusGProxy *proxy, property_cache *cache, filter_evaluation *eval);
+void match_log_stats(match *m);
 
 int match_get_automount(match *m);
 gchar *match_get_automount_filesystem(match *m);
 gchar **match_get_automount_options(match *m);
 
-const char *match_get_post_insertion_command(match *m);
-const char *match_get_post_mount_command(match *m);
-const char *match_get_post_unmount_command(match *m);
-const char *match_get_post_removal_command(match *m);
+command *match_get_post_insertion_command(match *m);
+command *match_get_post_mount_command(match *m);
+command *match_get_post_unmount_command(match *m);
+command *match_get_post_removal_command(match *m);
+
+coprocess *match_get_coprocess(match *m);
 
 #endif
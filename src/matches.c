@@ -16,13 +16,53 @@
 #include "match.h"
 #include "property_cache.h"
 
-static GSList *matches = NULL;
+// Matches in order of priority
+static GPtrArray *matches = NULL;
 static match *default_match = NULL;
 
+// Matches whose filter requires an exact UUID or label are only candidates
+// for devices with that value; the positions in each bucket are ascending
+typedef struct {
+    string_property property;
+    GHashTable *buckets;
+} match_index;
+
+#define NUM_MATCH_INDEXES 2
+static match_index indexes[NUM_MATCH_INDEXES] = {
+    { { PROPERTY_ID_CHECKED(ID_UUID, string) }, NULL },
+    { { PROPERTY_ID_CHECKED(ID_LABEL, string) }, NULL }
+};
+
+// Positions of the matches that can't be indexed
+static GArray *unindexed = NULL;
+
+static void index_match(match *m, guint position)
+{
+    filter *f = match_get_filter(m);
+    for (int i = 0; f && i < NUM_MATCH_INDEXES; ++i) {
+        const char *value;
+        if (filter_get_string_equality(f, indexes[i].property, &value)) {
+            GArray *bucket = g_hash_table_lookup(indexes[i].buckets, value);
+            if (!bucket) {
+                bucket = g_array_new(FALSE, FALSE, sizeof(guint));
+                g_hash_table_insert(indexes[i].buckets, g_strdup(value), bucket);
+            }
+            g_array_append_val(bucket, position);
+            return;
+        }
+    }
+    g_array_append_val(unindexed, position);
+}
+
 int matches_init(cfg_t *cfg)
 {
-    int index = cfg_size(cfg, "match");
-    while (index--) {
+    matches = g_ptr_array_new();
+    unindexed = g_array_new(FALSE, FALSE, sizeof(guint));
+    for (int i = 0; i < NUM_MATCH_INDEXES; ++i)
+        indexes[i].buckets = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, (GDestroyNotify)&g_array_unref);
+
+    int num_matches = cfg_size(cfg, "match");
+    for (int index = 0; index < num_matches; ++index) {
         cfg_t *sec = cfg_getnsec(cfg, "match", index);
 
         filter *f = filters_find_filter_by_name(cfg_title(sec));
@@ -32,28 +72,78 @@ int matches_init(cfg_t *cfg)
         }
 
         match *m = match_create(sec, f);
-        matches = g_slist_prepend(matches, m);
+        if (!m)
+            return 0;
+        index_match(m, matches->len);
+        g_ptr_array_add(matches, m);
     }
 
-    if (cfg_size(cfg, "default"))
+    if (cfg_size(cfg, "default")) {
         default_match = match_create(cfg_getsec(cfg, "default"), NULL);
+        if (!default_match)
+            return 0;
+    }
 
     return 1;
 }
 
 void matches_free(void)
 {
-    g_slist_foreach(matches, (GFunc)match_free, NULL);
+    if (matches) {
+        g_ptr_array_foreach(matches, (GFunc)match_free, NULL);
+        g_ptr_array_free(matches, TRUE);
+    }
+    if (unindexed)
+        g_array_free(unindexed, TRUE);
+    for (int i = 0; i < NUM_MATCH_INDEXES; ++i) {
+        if (indexes[i].buckets)
+            g_hash_table_destroy(indexes[i].buckets);
+    }
     if (default_match)
         match_free(default_match);
 }
 
+void matches_log_stats(void)
+{
+    for (guint i = 0; matches && i < matches->len; ++i)
+        match_log_stats(g_ptr_array_index(matches, i));
+    if (default_match)
+        match_log_stats(default_match);
+}
+
 match *matches_find_match(DBusGProxy *proxy, property_cache *cache)
 {
-    for (GSList *entry = matches; entry; entry = g_slist_next(entry)) {
-        match *m = (match *)entry->data;
-        if (match_matches(m, proxy, cache))
-            return m;
+    // The candidates are the unindexed matches and those indexed under the
+    // device's own values
+    GArray *candidates[NUM_MATCH_INDEXES + 1];
+    guint next[NUM_MATCH_INDEXES + 1] = { 0 };
+    candidates[0] = unindexed;
+    for (int i = 0; i < NUM_MATCH_INDEXES; ++i) {
+        const char *value = get_string_property_cached(cache, proxy, indexes[i].property);
+        candidates[i + 1] = value ? g_hash_table_lookup(indexes[i].buckets, value) : NULL;
+    }
+
+    // Restrictions and filters shared by several matches are only evaluated
+    // once, and the candidates are merged so that the first match still wins
+    match *res = default_match;
+    filter_evaluation *eval = filter_evaluation_create();
+    for (;;) {
+        int best = -1;
+        for (int i = 0; i < NUM_MATCH_INDEXES + 1; ++i) {
+            if (candidates[i] && next[i] < candidates[i]->len
+                    && (best < 0 || g_array_index(candidates[i], guint, next[i]) < g_array_index(candidates[best], guint, next[best])))
+                best = i;
+        }
+        if (best < 0)
+            break;
+
+        guint position = g_array_index(candidates[best], guint, next[best]++);
+        match *m = g_ptr_array_index(matches, position);
+        if (match_matches(m, proxy, cache, eval)) {
+            res = m;
+            break;
+        }
     }
-    return default_match;
+    filter_evaluation_free(eval);
+    return res;
 }
@@ -16,6 +16,7 @@
 
 int matches_init(cfg_t *cfg);
 void matches_free(void);
+void matches_log_stats(void);
 
 match *matches_find_match(DBusGProxy *proxy, property_cache *cache);
 
@@ -0,0 +1,138 @@
+/*
+ * This file is part of udisks-glue.
+ *
+ * © 2011 Fernando Tarlá Cardoso Lemos
+ *
+ * Refer to the LICENSE file for licensing information.
+ *
+ */
+
+#include <confuse.h>
+#include <dlfcn.h>
+#include <glib.h>
+
+#include "plugins.h"
+#include "property_cache.h"
+#include "tracked_object.h"
+#include "udisks-glue-plugin.h"
+
+typedef struct {
+    void *handle;
+    udisks_glue_plugin plugin;
+} loaded_plugin;
+
+static GSList *plugins = NULL;
+
+static void loaded_plugin_free(loaded_plugin *lp)
+{
+    if (lp->plugin.unload)
+        lp->plugin.unload(lp->plugin.data);
+    dlclose(lp->handle);
+    g_free(lp);
+}
+
+int plugins_init(cfg_t *cfg)
+{
+    int num_plugins = cfg_size(cfg, "plugins");
+    for (int i = 0; i < num_plugins; ++i) {
+        const char *path = cfg_getnstr(cfg, "plugins", i);
+        void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (!handle) {
+            g_printerr("Unable to load plugin %s: %s\n", path, dlerror());
+            return 0;
+        }
+
+        int (*init)(udisks_glue_plugin *) = (int (*)(udisks_glue_plugin *))dlsym(handle, "udisks_glue_plugin_init");
+        if (!init) {
+            g_printerr("Plugin %s doesn't export udisks_glue_plugin_init\n", path);
+            dlclose(handle);
+            return 0;
+        }
+
+        loaded_plugin *lp = g_malloc0(sizeof(loaded_plugin));
+        lp->handle = handle;
+        lp->plugin.api_version = UDISKS_GLUE_PLUGIN_API_VERSION;
+        if (!init(&lp->plugin)) {
+            g_printerr("Unable to initialize plugin %s\n", path);
+            dlclose(handle);
+            g_free(lp);
+            return 0;
+        }
+
+        plugins = g_slist_append(plugins, lp);
+    }
+
+    return 1;
+}
+
+void plugins_free(void)
+{
+    g_slist_foreach(plugins, (GFunc)loaded_plugin_free, NULL);
+    g_slist_free(plugins);
+    plugins = NULL;
+}
+
+static property_cache *event_cache(const udisks_glue_event *event, const char *name, property_type type, property_id *id)
+{
+    if (!property_find_by_name(name, id) || property_get_type(*id) != type)
+        return NULL;
+    return tracked_object_get_property_cache(event->priv);
+}
+
+static int event_get_bool(const udisks_glue_event *event, const char *name, int *value)
+{
+    property_id id;
+    property_cache *cache = event_cache(event, name, PROPERTY_TYPE_bool, &id);
+    return cache ? property_cache_peek_bool(cache, (bool_property){ id }, value) : 0;
+}
+
+static int event_get_uint32(const udisks_glue_event *event, const char *name, uint32_t *value)
+{
+    property_id id;
+    property_cache *cache = event_cache(event, name, PROPERTY_TYPE_uint32, &id);
+    return cache ? property_cache_peek_uint32(cache, (uint32_property){ id }, value) : 0;
+}
+
+static int event_get_string(const udisks_glue_event *event, const char *name, const char **value)
+{
+    property_id id;
+    property_cache *cache = event_cache(event, name, PROPERTY_TYPE_string, &id);
+    return cache ? property_cache_peek_string(cache, (string_property){ id }, value) : 0;
+}
+
+static int event_get_stringv(const udisks_glue_event *event, const char *name, const char * const **value)
+{
+    property_id id;
+    property_cache *cache = event_cache(event, name, PROPERTY_TYPE_stringv, &id);
+    return cache ? property_cache_peek_stringv(cache, (stringv_property){ id }, value) : 0;
+}
+
+void plugins_notify(plugin_event event, tracked_object *tobj, const char *mount_point)
+{
+    if (!plugins)
+        return;
+
+    udisks_glue_event ev = {
+        .object_path = tracked_object_get_object_path(tobj),
+        .device_file = tracked_object_get_device_file(tobj),
+        .mount_point = mount_point,
+        .get_bool = &event_get_bool,
+        .get_uint32 = &event_get_uint32,
+        .get_string = &event_get_string,
+        .get_stringv = &event_get_stringv,
+        .priv = tobj
+    };
+
+    for (GSList *entry = plugins; entry; entry = g_slist_next(entry)) {
+        udisks_glue_plugin *plugin = &((loaded_plugin *)entry->data)->plugin;
+        udisks_glue_event_callback callback = NULL;
+        switch (event) {
+            case PLUGIN_EVENT_INSERTION: callback = plugin->insertion; break;
+            case PLUGIN_EVENT_MOUNT: callback = plugin->mount; break;
+            case PLUGIN_EVENT_UNMOUNT: callback = plugin->unmount; break;
+            case PLUGIN_EVENT_REMOVAL: callback = plugin->removal; break;
+        }
+        if (callback)
+            callback(&ev, plugin->data);
+    }
+}
@@ -0,0 +1,29 @@
+/*
+ * This file is part of udisks-glue.
+ *
+ * © 2011 Fernando Tarlá Cardoso Lemos
+ *
+ * Refer to the LICENSE file for licensing information.
+ *
+ */
+
+#ifndef PLUGINS_H
+#define PLUGINS_H
+
+#include <confuse.h>
+
+#include "tracked_object.h"
+
+typedef enum {
+    PLUGIN_EVENT_INSERTION,
+    PLUGIN_EVENT_MOUNT,
+    PLUGIN_EVENT_UNMOUNT,
+    PLUGIN_EVENT_REMOVAL
+} plugin_event;
+
+int plugins_init(cfg_t *cfg);
+void plugins_free(void);
+
+void plugins_notify(plugin_event event, tracked_object *tobj, const char *mount_point);
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * This file is part of udisks-glue.
+ *
+ * © 2011 Fernando Tarlá Cardoso Lemos
+ *
+ * Refer to the LICENSE file for licensing information.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+
+#include "process.h"
+
+// Seconds a process that timed out gets to exit before it's killed
+#define PROCESS_KILL_GRACE 5
+
+typedef struct {
+    pid_t pid;
+    guint timeout_source;
+    process_result res;
+    process_callback callback;
+    void *user_data;
+} process;
+
+static GHashTable *processes;
+static int sigchld_pipe[2] = { -1, -1 };
+static guint sigchld_watch;
+static struct sigaction previous_sigchld;
+
+static void sigchld_handler(int sig)
+{
+    // Only wake up the main loop, the children are reaped from there
+    int saved_errno = errno;
+    ssize_t res = write(sigchld_pipe[1], "", 1);
+    (void)res;
+    errno = saved_errno;
+
+    // Whoever was handling the signal before still needs to know
+    if (!(previous_sigchld.sa_flags & SA_SIGINFO) && previous_sigchld.sa_handler != SIG_DFL
+            && previous_sigchld.sa_handler != SIG_IGN)
+        previous_sigchld.sa_handler(sig);
+}
+
+static void process_free_one(process *p)
+{
+    if (p->timeout_source)
+        g_source_remove(p->timeout_source);
+    g_free(p);
+}
+
+static gboolean sigchld_ready(GIOChannel *source, GIOCondition condition, gpointer user_data)
+{
+    char buf[64];
+    while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0);
+
+    // Only reap our own children, others (spawned by plugins or through glib)
+    // are left for whoever started them. The callbacks can spawn processes,
+    // so look at the ones running now.
+    GList *pids = g_hash_table_get_keys(processes);
+    for (GList *entry = pids; entry; entry = entry->next) {
+        // Unlike waitpid(), wait4() also tells us about the resources used
+        pid_t pid = GPOINTER_TO_INT(entry->data);
+        int status;
+        struct rusage usage;
+        if (wait4(pid, &status, WNOHANG, &usage) != pid)
+            continue;
+
+        process *p = g_hash_table_lookup(processes, GINT_TO_POINTER(pid));
+        g_hash_table_steal(processes, GINT_TO_POINTER(pid));
+
+        p->res.status = status;
+        p->res.end_time = g_get_monotonic_time();
+        p->res.usage = usage;
+
+        // The rest of a group that timed out doesn't get the leader's grace
+        // period, the kill timer goes away with the process
+        if (p->res.timed_out)
+            kill(-pid, SIGKILL);
+
+        if (p->callback)
+            p->callback(&p->res, p->user_data);
+        process_free_one(p);
+    }
+    g_list_free(pids);
+
+    return TRUE;
+}
+
+int process_init(void)
+{
+    GError *error = NULL;
+    if (!g_unix_open_pipe(sigchld_pipe, FD_CLOEXEC, &error)
+            || !g_unix_set_fd_nonblocking(sigchld_pipe[0], TRUE, &error)
+            || !g_unix_set_fd_nonblocking(sigchld_pipe[1], TRUE, &error)) {
+        g_printerr("Unable to create the child process pipe: %s\n", error->message);
+        g_error_free(error);
+        return 0;
+    }
+
+    GIOChannel *channel = g_io_channel_unix_new(sigchld_pipe[0]);
+    sigchld_watch = g_io_add_watch(channel, G_IO_IN, &sigchld_ready, NULL);
+    g_io_channel_unref(channel);
+
+    struct sigaction sa;
+    sa.sa_handler = &sigchld_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, &previous_sigchld);
+
+    // Writing to a child that went away must not kill us
+    signal(SIGPIPE, SIG_IGN);
+
+    processes = g_hash_table_new_full(&g_direct_hash, &g_direct_equal, NULL, (GDestroyNotify)&process_free_one);
+    return 1;
+}
+
+void process_free(void)
+{
+    if (sigchld_watch) {
+        sigaction(SIGCHLD, &previous_sigchld, NULL);
+        g_source_remove(sigchld_watch);
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (sigchld_pipe[i] != -1)
+            close(sigchld_pipe[i]);
+    }
+    if (processes)
+        g_hash_table_destroy(processes);
+}
+
+static gboolean process_kill(gpointer user_data)
+{
+    process *p = user_data;
+    p->timeout_source = 0;
+    kill(-p->pid, SIGKILL);
+    return FALSE;
+}
+
+static gboolean process_timeout(gpointer user_data)
+{
+    // Ask the whole process group to go away, then insist
+    process *p = user_data;
+    p->res.timed_out = 1;
+    kill(-p->pid, SIGTERM);
+    p->timeout_source = g_timeout_add_seconds(PROCESS_KILL_GRACE, &process_kill, p);
+    return FALSE;
+}
+
+int process_spawn(gchar **argv, gchar **envp, guint timeout, int stdin_fd, process_callback callback, void *user_data)
+{
+    // We ignore SIGPIPE, but the children shouldn't
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    short flags = POSIX_SPAWN_SETSIGDEF;
+    sigset_t sigdefault;
+    sigemptyset(&sigdefault);
+    sigaddset(&sigdefault, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &sigdefault);
+
+    // Processes that can time out get their own group, so that whatever
+    // they started can be killed along with them
+    if (timeout) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (stdin_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, stdin_fd, STDIN_FILENO);
+
+    // Spawn the command without duplicating our address space
+    pid_t pid;
+    gint64 start_time = g_get_monotonic_time();
+    int res = posix_spawnp(&pid, argv[0], &actions, &attr, argv, envp ? envp : environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (res != 0) {
+        g_printerr("Unable to run %s: %s\n", argv[0], g_strerror(res));
+        return 0;
+    }
+
+    process *p = g_malloc0(sizeof(process));
+    p->pid = pid;
+    p->res.start_time = start_time;
+    p->callback = callback;
+    p->user_data = user_data;
+    if (timeout)
+        p->timeout_source = g_timeout_add_seconds(timeout, &process_timeout, p);
+    g_hash_table_insert(processes, GINT_TO_POINTER(pid), p);
+    return 1;
+}
@@ -0,0 +1,32 @@
+/*
+ * This file is part of udisks-glue.
+ *
+ * © 2011 Fernando Tarlá Cardoso Lemos
+ *
+ * Refer to the LICENSE file for licensing information.
+ *
+ */
+
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include <sys/resource.h>
+#include <glib.h>
+
+typedef struct {
+    int status;
+    int timed_out;
+    gint64 start_time;
+    gint64 end_time;
+    struct rusage usage;
+} process_result;
+
+typedef void (*process_callback)(const process_result *res, void *user_data);
+
+int process_init(void);
+void process_free(void);
+
+// envp is NULL and stdin_fd is -1 to let the child inherit ours
+int process_spawn(gchar **argv, gchar **envp, guint timeout, int stdin_fd, process_callback callback, void *user_data);
+
+#endif
@@ -9,150 +9,331 @@
 
 #include <assert.h>
 #include <glib.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "dbus_constants.h"
 #include "property_cache.h"
 #include "props.h"
 
-typedef struct {
-    enum {
-        CACHE_VALUE_TYPE_INT16,
-        CACHE_VALUE_TYPE_INT32,
-        CACHE_VALUE_TYPE_INT64,
-        CACHE_VALUE_TYPE_UINT16,
-        CACHE_VALUE_TYPE_UINT32,
-        CACHE_VALUE_TYPE_UINT64,
-        CACHE_VALUE_TYPE_BOOL,
-        CACHE_VALUE_TYPE_STRING,
-        CACHE_VALUE_TYPE_STRINGV
-    } type;
-    union {
-        int16_t int16_value;
-        int32_t int32_value;
-        int64_t int64_value;
-        uint16_t uint16_value;
-        uint32_t uint32_value;
-        uint64_t uint64_value;
-        int bool_value;
-        gchar *string_value;
-        gchar **stringv_value;
-    } values;
-} cache_value;
+typedef union {
+    int bool_value;
+    gchar *string_value;
+    gchar **stringv_value;
+    uint32_t uint32_value;
+} property_value;
+
+typedef uint64_t property_bitmap;
+typedef char property_bitmap_is_large_enough[NUM_PROPERTIES < sizeof(property_bitmap) * 8 ? 1 : -1];
+
+#define PROPERTY_BIT(id) ((property_bitmap)1 << (id))
+#define ALL_PROPERTY_BITS (PROPERTY_BIT(NUM_PROPERTIES) - 1)
 
 struct property_cache_ {
-    GHashTable *entries;
+    property_value values[NUM_PROPERTIES];
+    property_bitmap present;
+    property_bitmap failed;
+    int bulk_loaded;
 };
 
-#define IMPLEMENT_CACHE_VALUE_COPY(c_type, e_type, name) \
-    static cache_value *cache_value_create_##name(c_type val) \
-    { \
-        cache_value *value = g_malloc0(sizeof(cache_value)); \
-        value->type = CACHE_VALUE_TYPE_##e_type; \
-        value->values.name##_value = val; \
-        return value; \
+static const struct {
+    const char *name;
+    property_type type;
+    property_scope scope;
+} property_info[NUM_PROPERTIES] = {
+#define X(id, name, type, scope) { name, PROPERTY_TYPE_##type, PROPERTY_SCOPE_##scope },
+    PROPERTY_TABLE(X)
+#undef X
+};
+
+const char *property_get_name(property_id id)
+{
+    return property_info[id].name;
+}
+
+property_type property_get_type(property_id id)
+{
+    return property_info[id].type;
+}
+
+static int compare_property_names(const void *a, const void *b)
+{
+    return strcmp(property_info[*(const property_id *)a].name, property_info[*(const property_id *)b].name);
+}
+
+static int compare_name_to_property(const void *name, const void *id)
+{
+    return strcmp(name, property_info[*(const property_id *)id].name);
+}
+
+int property_find_by_name(const char *name, property_id *id)
+{
+    // Sort the properties by name once so that GetAll results can be bisected
+    static property_id sorted[NUM_PROPERTIES];
+    static int sorted_initialized = 0;
+    if (!sorted_initialized) {
+        for (int i = 0; i < NUM_PROPERTIES; ++i)
+            sorted[i] = i;
+        qsort(sorted, NUM_PROPERTIES, sizeof(property_id), &compare_property_names);
+        sorted_initialized = 1;
     }
 
-IMPLEMENT_CACHE_VALUE_COPY(int16_t, INT16, int16)
-IMPLEMENT_CACHE_VALUE_COPY(int32_t, INT32, int32)
-IMPLEMENT_CACHE_VALUE_COPY(int64_t, INT64, int64)
-IMPLEMENT_CACHE_VALUE_COPY(uint16_t, UINT16, uint16)
-IMPLEMENT_CACHE_VALUE_COPY(uint32_t, UINT32, uint32)
-IMPLEMENT_CACHE_VALUE_COPY(uint64_t, UINT64, uint64)
-IMPLEMENT_CACHE_VALUE_COPY(int, BOOL, bool)
-IMPLEMENT_CACHE_VALUE_COPY(gchar *, STRING, string)
-IMPLEMENT_CACHE_VALUE_COPY(gchar **, STRINGV, stringv)
-
-static void cache_value_free(cache_value *value)
-{
-    switch (value->type) {
-        case CACHE_VALUE_TYPE_INT16: break;
-        case CACHE_VALUE_TYPE_INT32: break;
-        case CACHE_VALUE_TYPE_INT64: break;
-        case CACHE_VALUE_TYPE_UINT16: break;
-        case CACHE_VALUE_TYPE_UINT32: break;
-        case CACHE_VALUE_TYPE_UINT64: break;
-        case CACHE_VALUE_TYPE_BOOL: break;
-        case CACHE_VALUE_TYPE_STRING: g_free(value->values.string_value); break;
-        case CACHE_VALUE_TYPE_STRINGV: g_strfreev(value->values.stringv_value); break;
+    property_id *res = bsearch(name, sorted, NUM_PROPERTIES, sizeof(property_id), &compare_name_to_property);
+    if (!res)
+        return 0;
+    *id = *res;
+    return 1;
+}
+
+static void clear_value(property_cache *cache, property_id id)
+{
+    if (!(cache->present & PROPERTY_BIT(id)))
+        return;
+
+    switch (property_info[id].type) {
+        case PROPERTY_TYPE_bool: break;
+        case PROPERTY_TYPE_uint32: break;
+        case PROPERTY_TYPE_string: g_free(cache->values[id].string_value); break;
+        case PROPERTY_TYPE_stringv: g_strfreev(cache->values[id].stringv_value); break;
         default: assert(0); break;
     }
-    g_free(value);
+    cache->present &= ~PROPERTY_BIT(id);
+}
+
+static void set_value(property_cache *cache, property_id id, property_value value)
+{
+    clear_value(cache, id);
+    cache->values[id] = value;
+    cache->present |= PROPERTY_BIT(id);
+    cache->failed &= ~PROPERTY_BIT(id);
+}
+
+static int set_value_from_gvalue(property_cache *cache, property_id id, const GValue *gvalue)
+{
+    property_value value;
+    GType type = G_VALUE_TYPE(gvalue);
+    switch (property_info[id].type) {
+        case PROPERTY_TYPE_bool:
+            if (type != G_TYPE_BOOLEAN)
+                return 0;
+            value.bool_value = g_value_get_boolean(gvalue) ? BOOL_PROP_TRUE : BOOL_PROP_FALSE;
+            break;
+        case PROPERTY_TYPE_string:
+            if (type != G_TYPE_STRING)
+                return 0;
+            value.string_value = g_strdup(g_value_get_string(gvalue));
+            break;
+        case PROPERTY_TYPE_stringv:
+            if (type != G_TYPE_STRV)
+                return 0;
+            value.stringv_value = g_strdupv(g_value_get_boxed(gvalue));
+            break;
+        case PROPERTY_TYPE_uint32:
+            if (type != G_TYPE_UINT)
+                return 0;
+            value.uint32_value = g_value_get_uint(gvalue);
+            break;
+        default:
+            assert(0);
+            return 0;
+    }
+    set_value(cache, id, value);
+    return 1;
 }
 
 property_cache *property_cache_create(void)
 {
-    property_cache *cache = g_malloc(sizeof(property_cache));
-    cache->entries = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, (GDestroyNotify)&cache_value_free);
-    return cache;
+    return g_malloc0(sizeof(property_cache));
 }
 
 void property_cache_free(property_cache *cache)
 {
-    g_hash_table_destroy(cache->entries);
+    property_cache_purge(cache);
     g_free(cache);
 }
 
 void property_cache_purge(property_cache *cache)
 {
-    g_hash_table_remove_all(cache->entries);
-}
-
-#define IMPLEMENT_GET_NUMBER_PROPERTY_CACHED(c_type, name) \
-    c_type get_##name##_property_cached(property_cache *cache, DBusGProxy *proxy, const char *name, const char *interface, int *success) \
-    { \
-        cache_value *value = g_hash_table_lookup(cache->entries, name); \
-        if (value) { \
-            if (success) \
-                *success = 1; \
-            return value->values.name##_value; \
-        } \
-        int my_success; \
-        c_type res = get_##name##_property(proxy, name, interface, &my_success); \
-        if (my_success) \
-            g_hash_table_insert(cache->entries, g_strdup(name), cache_value_create_##name(res)); \
-        if (success) \
-            *success = my_success; \
-        return res; \
+    for (int i = 0; i < NUM_PROPERTIES; ++i)
+        clear_value(cache, i);
+    cache->failed = 0;
+    cache->bulk_loaded = 0;
+}
+
+void property_cache_purge_media(property_cache *cache)
+{
+    for (int i = 0; i < NUM_PROPERTIES; ++i) {
+        if (property_info[i].scope == PROPERTY_SCOPE_MEDIA) {
+            clear_value(cache, i);
+            cache->failed &= ~PROPERTY_BIT(i);
+        }
+    }
+
+    // The next lookup of a media property reloads everything in one go
+    cache->bulk_loaded = 0;
+}
+
+void property_cache_load(property_cache *cache, GHashTable *props)
+{
+    property_bitmap loaded = 0;
+    GHashTableIter iter;
+    gpointer name, value;
+    g_hash_table_iter_init(&iter, props);
+    while (g_hash_table_iter_next(&iter, &name, &value)) {
+        property_id id;
+        if (property_find_by_name(name, &id) && set_value_from_gvalue(cache, id, value))
+            loaded |= PROPERTY_BIT(id);
     }
 
-IMPLEMENT_GET_NUMBER_PROPERTY_CACHED(int16_t, int16)
-IMPLEMENT_GET_NUMBER_PROPERTY_CACHED(int32_t, int32)
-IMPLEMENT_GET_NUMBER_PROPERTY_CACHED(int64_t, int64)
-IMPLEMENT_GET_NUMBER_PROPERTY_CACHED(uint16_t, uint16)
-IMPLEMENT_GET_NUMBER_PROPERTY_CACHED(uint32_t, uint32)
-IMPLEMENT_GET_NUMBER_PROPERTY_CACHED(uint64_t, uint64)
+    // A GetAll result is complete, so whatever it didn't provide is gone and
+    // can't be fetched individually either
+    for (int i = 0; i < NUM_PROPERTIES; ++i) {
+        if (!(loaded & PROPERTY_BIT(i)))
+            clear_value(cache, i);
+    }
+    cache->failed = ALL_PROPERTY_BITS & ~loaded;
+    cache->bulk_loaded = 1;
+}
 
-int get_bool_property_cached(property_cache *cache, DBusGProxy *proxy, const char *name, const char *interface)
+int property_cache_load_all(property_cache *cache, DBusGProxy *proxy)
 {
-    cache_value *value = g_hash_table_lookup(cache->entries, name);
-    if (value) return value->values.bool_value;
+    GHashTable *props = get_all_properties(proxy, DBUS_INTERFACE_UDISKS_DEVICE);
+    if (!props)
+        return 0;
 
-    int res = get_bool_property(proxy, name, interface);
-    if (res != BOOL_PROP_ERROR)
-        g_hash_table_insert(cache->entries, g_strdup(name), cache_value_create_bool(res));
+    property_cache_load(cache, props);
+    g_hash_table_destroy(props);
+    return 1;
+}
+
+// Returns NULL if the property has to be fetched, and sets *failed if an
+// earlier attempt to fetch it failed since the last time the cache was loaded
+static property_value *lookup(property_cache *cache, DBusGProxy *proxy, property_id id, int *failed)
+{
+    *failed = 0;
+    if (cache->present & PROPERTY_BIT(id))
+        return &cache->values[id];
+    if (cache->failed & PROPERTY_BIT(id)) {
+        *failed = 1;
+        return NULL;
+    }
 
-    return res;
+    // Only try to bulk load once until the cache is purged, even if GetAll fails
+    if (!cache->bulk_loaded) {
+        cache->bulk_loaded = 1;
+        property_cache_load_all(cache, proxy);
+        if (cache->present & PROPERTY_BIT(id))
+            return &cache->values[id];
+        if (cache->failed & PROPERTY_BIT(id)) {
+            *failed = 1;
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+uint32_t get_uint32_property_cached(property_cache *cache, DBusGProxy *proxy, uint32_property property, int *success)
+{
+    int failed;
+    property_value *value = lookup(cache, proxy, property.id, &failed);
+    if (value || failed) {
+        if (success)
+            *success = value ? 1 : 0;
+        return value ? value->uint32_value : 0;
+    }
+
+    int my_success;
+    property_value res;
+    res.uint32_value = get_uint32_property(proxy, property_info[property.id].name, DBUS_INTERFACE_UDISKS_DEVICE, &my_success);
+    if (my_success)
+        set_value(cache, property.id, res);
+    else
+        cache->failed |= PROPERTY_BIT(property.id);
+    if (success)
+        *success = my_success;
+    return res.uint32_value;
 }
 
-gchar *get_string_property_cached(property_cache *cache, DBusGProxy *proxy, const char *name, const char *interface)
+int get_bool_property_cached(property_cache *cache, DBusGProxy *proxy, bool_property property)
 {
-    cache_value *value = g_hash_table_lookup(cache->entries, name);
-    if (value) return value->values.string_value;
+    int failed;
+    property_value *value = lookup(cache, proxy, property.id, &failed);
+    if (value) return value->bool_value;
+    if (failed) return BOOL_PROP_ERROR;
 
-    gchar *res = get_string_property(proxy, name, interface);
-    if (res)
-        g_hash_table_insert(cache->entries, g_strdup(name), cache_value_create_string(res));
+    property_value res;
+    res.bool_value = get_bool_property(proxy, property_info[property.id].name, DBUS_INTERFACE_UDISKS_DEVICE);
+    if (res.bool_value != BOOL_PROP_ERROR)
+        set_value(cache, property.id, res);
+    else
+        cache->failed |= PROPERTY_BIT(property.id);
 
-    return res;
+    return res.bool_value;
 }
 
-gchar **get_stringv_property_cached(property_cache *cache, DBusGProxy *proxy, const char *name, const char *interface)
+gchar *get_string_property_cached(property_cache *cache, DBusGProxy *proxy, string_property property)
 {
-    cache_value *value = g_hash_table_lookup(cache->entries, name);
-    if (value) return value->values.stringv_value;
+    int failed;
+    property_value *value = lookup(cache, proxy, property.id, &failed);
+    if (value) return value->string_value;
+    if (failed) return NULL;
 
-    gchar **res = get_stringv_property(proxy, name, interface);
-    if (res)
-        g_hash_table_insert(cache->entries, g_strdup(name), cache_value_create_stringv(res));
+    property_value res;
+    res.string_value = get_string_property(proxy, property_info[property.id].name, DBUS_INTERFACE_UDISKS_DEVICE);
+    if (res.string_value)
+        set_value(cache, property.id, res);
+    else
+        cache->failed |= PROPERTY_BIT(property.id);
 
-    return res;
+    return res.string_value;
+}
+
+gchar **get_stringv_property_cached(property_cache *cache, DBusGProxy *proxy, stringv_property property)
+{
+    int failed;
+    property_value *value = lookup(cache, proxy, property.id, &failed);
+    if (value) return value->stringv_value;
+    if (failed) return NULL;
+
+    property_value res;
+    res.stringv_value = get_stringv_property(proxy, property_info[property.id].name, DBUS_INTERFACE_UDISKS_DEVICE);
+    if (res.stringv_value)
+        set_value(cache, property.id, res);
+    else
+        cache->failed |= PROPERTY_BIT(property.id);
+
+    return res.stringv_value;
+}
+
+int property_cache_peek_bool(property_cache *cache, bool_property property, int *value)
+{
+    if (!(cache->present & PROPERTY_BIT(property.id)))
+        return 0;
+    *value = cache->values[property.id].bool_value;
+    return 1;
+}
+
+int property_cache_peek_uint32(property_cache *cache, uint32_property property, uint32_t *value)
+{
+    if (!(cache->present & PROPERTY_BIT(property.id)))
+        return 0;
+    *value = cache->values[property.id].uint32_value;
+    return 1;
+}
+
+int property_cache_peek_string(property_cache *cache, string_property property, const char **value)
+{
+    if (!(cache->present & PROPERTY_BIT(property.id)))
+        return 0;
+    *value = cache->values[property.id].string_value;
+    return 1;
+}
+
+int property_cache_peek_stringv(property_cache *cache, stringv_property property, const char * const **value)
+{
+    if (!(cache->present & PROPERTY_BIT(property.id)))
+        return 0;
+    *value = (const char * const *)cache->values[property.id].stringv_value;
+    return 1;
 }
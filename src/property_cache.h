@@ -14,21 +14,94 @@
 #include <glib.h>
 #include <stdint.h>
 
+// The udisks device properties we ever look at, with the type of their values
+// and whether they describe the drive or the media currently in it (which
+// only decides what property_cache_purge_media() clears, since a refresh
+// replaces everything)
+#define PROPERTY_TABLE(X) \
+    X(DEVICE_FILE, "DeviceFile", string, DRIVE) \
+    X(DEVICE_IS_SYSTEM_INTERNAL, "DeviceIsSystemInternal", bool, DRIVE) \
+    X(DEVICE_IS_REMOVABLE, "DeviceIsRemovable", bool, DRIVE) \
+    X(DEVICE_IS_READ_ONLY, "DeviceIsReadOnly", bool, MEDIA) \
+    X(DEVICE_IS_PARTITION, "DeviceIsPartition", bool, DRIVE) \
+    X(DEVICE_IS_PARTITION_TABLE, "DeviceIsPartitionTable", bool, MEDIA) \
+    X(DEVICE_IS_OPTICAL_DISC, "DeviceIsOpticalDisc", bool, MEDIA) \
+    X(DEVICE_IS_MEDIA_AVAILABLE, "DeviceIsMediaAvailable", bool, MEDIA) \
+    X(DEVICE_IS_MOUNTED, "DeviceIsMounted", bool, MEDIA) \
+    X(DEVICE_MOUNT_PATHS, "DeviceMountPaths", stringv, MEDIA) \
+    X(ID_USAGE, "IdUsage", string, MEDIA) \
+    X(ID_TYPE, "IdType", string, MEDIA) \
+    X(ID_UUID, "IdUuid", string, MEDIA) \
+    X(ID_LABEL, "IdLabel", string, MEDIA) \
+    X(OPTICAL_DISC_IS_CLOSED, "OpticalDiscIsClosed", bool, MEDIA) \
+    X(OPTICAL_DISC_NUM_TRACKS, "OpticalDiscNumTracks", uint32, MEDIA) \
+    X(OPTICAL_DISC_NUM_AUDIO_TRACKS, "OpticalDiscNumAudioTracks", uint32, MEDIA)
+
+typedef enum {
+#define X(id, name, type, scope) PROPERTY_##id,
+    PROPERTY_TABLE(X)
+#undef X
+    NUM_PROPERTIES
+} property_id;
+
+// The suffixes match the type column of the table
+typedef enum {
+    PROPERTY_TYPE_bool,
+    PROPERTY_TYPE_string,
+    PROPERTY_TYPE_stringv,
+    PROPERTY_TYPE_uint32
+} property_type;
+
+enum {
+#define X(id, name, type, scope) PROPERTY_TYPE_OF_##id = PROPERTY_TYPE_##type,
+    PROPERTY_TABLE(X)
+#undef X
+};
+
+typedef enum {
+    PROPERTY_SCOPE_DRIVE,
+    PROPERTY_SCOPE_MEDIA
+} property_scope;
+
+// Typed handles, so that the compiler rejects mismatched accessors
+typedef struct { property_id id; } bool_property;
+typedef struct { property_id id; } string_property;
+typedef struct { property_id id; } stringv_property;
+typedef struct { property_id id; } uint32_property;
+
+// Evaluates to PROPERTY_<id>, but fails to compile if its type isn't <type>
+#define PROPERTY_ID_CHECKED(id, type) \
+    (PROPERTY_##id + 0 * sizeof(char[(int)PROPERTY_TYPE_OF_##id == (int)PROPERTY_TYPE_##type ? 1 : -1]))
+
+#define BOOL_PROPERTY(id) ((bool_property){ PROPERTY_ID_CHECKED(id, bool) })
+#define STRING_PROPERTY(id) ((string_property){ PROPERTY_ID_CHECKED(id, string) })
+#define STRINGV_PROPERTY(id) ((stringv_property){ PROPERTY_ID_CHECKED(id, stringv) })
+#define UINT32_PROPERTY(id) ((uint32_property){ PROPERTY_ID_CHECKED(id, uint32) })
+
 typedef struct property_cache_ property_cache;
 
+const char *property_get_name(property_id id);
+property_type property_get_type(property_id id);
+int property_find_by_name(const char *name, property_id *id);
+
 property_cache *property_cache_create(void);
 void property_cache_free(property_cache *property_cache);
 
 void property_cache_purge(property_cache *cache);
+void property_cache_purge_media(property_cache *cache);
+
+int property_cache_load_all(property_cache *cache, DBusGProxy *proxy);
+void property_cache_load(property_cache *cache, GHashTable *props);
+
+uint32_t get_uint32_property_cached(property_cache *cache, DBusGProxy *proxy, uint32_property property, int *success);
+int get_bool_property_cached(property_cache *cache, DBusGProxy *proxy, bool_property property);
+gchar *get_string_property_cached(property_cache *cache, DBusGProxy *proxy, string_property property);
+gchar **get_stringv_property_cached(property_cache *cache, DBusGProxy *proxy, stringv_property property);
 
-int16_t get_int16_property_cached(property_cache *cache, DBusGProxy *proxy, const char *name, const char *interface, int *success);
-int32_t get_int32_property_cached(property_cache *cache, DBusGProxy *proxy, const char *name, const char *interface, int *success);
-int64_t get_int64_property_cached(property_cache *cache, DBusGProxy *proxy, const char *name, const char *interface, int *success);
-uint16_t get_uint16_property_cached(property_cache *cache, DBusGProxy *proxy, const char *name, const char *interface, int *success);
-uint32_t get_uint32_property_cached(property_cache *cache, DBusGProxy *proxy, const char *name, const char *interface, int *success);
-uint64_t get_uint64_property_cached(property_cache *cache, DBusGProxy *proxy, const char *name, const char *interface, int *success);
-int get_bool_property_cached(property_cache *cache, DBusGProxy *proxy, const char *name, const char *interface);
-gchar *get_string_property_cached(property_cache *cache, DBusGProxy *proxy, const char *name, const char *interface);
-gchar **get_stringv_property_cached(property_cache *cache, DBusGProxy *proxy, const char *name, const char *interface);
+// These only look at what's already in the cache and return 0 if it isn't
+int property_cache_peek_bool(property_cache *cache, bool_property property, int *value);
+int property_cache_peek_uint32(property_cache *cache, uint32_property property, uint32_t *value);
+int property_cache_peek_string(property_cache *cache, string_property property, const char **value);
+int property_cache_peek_stringv(property_cache *cache, stringv_property property, const char * const **value);
 
 #endif
@@ -42,7 +42,7 @@
             g_printerr("Unable to get property \"%s\": %s\n", name, error->message); \
             g_error_free(error); \
             if (success) \
-                success = 0; \
+                *success = 0; \
             return 0; \
         } \
         if (success) \
@@ -80,3 +80,57 @@ gchar **get_stringv_property(DBusGProxy *proxy, const char *name, const char *in
     g_value_unset(&value);
     return res;
 }
+
+GHashTable *get_all_properties(DBusGProxy *proxy, const char *interface)
+{
+    GError *error = NULL;
+    GHashTable *res = NULL;
+    if (!dbus_g_proxy_call(proxy, "GetAll", &error,
+                G_TYPE_STRING, interface,
+                G_TYPE_INVALID,
+                dbus_g_type_get_map("GHashTable", G_TYPE_STRING, G_TYPE_VALUE), &res,
+                G_TYPE_INVALID)) {
+        g_printerr("Unable to get the properties of \"%s\": %s\n", interface, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+    return res;
+}
+
+typedef struct {
+    get_all_properties_callback callback;
+    void *user_data;
+    const char *interface;
+} get_all_properties_call;
+
+static void get_all_properties_notify(DBusGProxy *proxy, DBusGProxyCall *call_id, void *user_data)
+{
+    get_all_properties_call *call = user_data;
+
+    GError *error = NULL;
+    GHashTable *res = NULL;
+    if (!dbus_g_proxy_end_call(proxy, call_id, &error,
+                dbus_g_type_get_map("GHashTable", G_TYPE_STRING, G_TYPE_VALUE), &res,
+                G_TYPE_INVALID)) {
+        g_printerr("Unable to get the properties of \"%s\": %s\n", call->interface, error->message);
+        g_error_free(error);
+        call->callback(NULL, call->user_data);
+        return;
+    }
+
+    call->callback(res, call->user_data);
+    g_hash_table_destroy(res);
+}
+
+DBusGProxyCall *get_all_properties_async(DBusGProxy *proxy, const char *interface, get_all_properties_callback callback, void *user_data)
+{
+    get_all_properties_call *call = g_malloc(sizeof(get_all_properties_call));
+    call->callback = callback;
+    call->user_data = user_data;
+    call->interface = interface;
+
+    // The call data is freed when the call completes or is cancelled
+    return dbus_g_proxy_begin_call(proxy, "GetAll", &get_all_properties_notify, call, &g_free,
+            G_TYPE_STRING, interface,
+            G_TYPE_INVALID);
+}
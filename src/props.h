@@ -18,6 +18,8 @@
 #define BOOL_PROP_FALSE 0
 #define BOOL_PROP_ERROR -1
 
+typedef void (*get_all_properties_callback)(GHashTable *props, void *user_data);
+
 int16_t get_int16_property(DBusGProxy *proxy, const char *name, const char *interface, int *success);
 int32_t get_int32_property(DBusGProxy *proxy, const char *name, const char *interface, int *success);
 int64_t get_int64_property(DBusGProxy *proxy, const char *name, const char *interface, int *success);
@@ -28,4 +30,7 @@ int get_bool_property(DBusGProxy *proxy, const char *name, const char *interface
 gchar *get_string_property(DBusGProxy *proxy, const char *name, const char *interface);
 gchar **get_stringv_property(DBusGProxy *proxy, const char *name, const char *interface);
 
+GHashTable *get_all_properties(DBusGProxy *proxy, const char *interface);
+DBusGProxyCall *get_all_properties_async(DBusGProxy *proxy, const char *interface, get_all_properties_callback callback, void *user_data);
+
 #endif
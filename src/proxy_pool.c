@@ -0,0 +1,65 @@
+/*
+ * This file is part of udisks-glue.
+ *
+ * © 2011 Fernando Tarlá Cardoso Lemos
+ *
+ * Refer to the LICENSE file for licensing information.
+ *
+ */
+
+#include <dbus/dbus-glib.h>
+#include <glib.h>
+
+#include "dbus_constants.h"
+#include "globals.h"
+#include "proxy_pool.h"
+
+// Idle properties proxies are kept around for devices that come back at the
+// same object path, such as the partitions of a disk that is plugged again
+#define PROXY_POOL_SIZE 32
+
+static GHashTable *idle_proxies;
+static GQueue idle_order = G_QUEUE_INIT;
+
+DBusGProxy *proxy_pool_acquire(const char *object_path)
+{
+    gpointer key, proxy;
+    if (idle_proxies && g_hash_table_lookup_extended(idle_proxies, object_path, &key, &proxy)) {
+        g_queue_remove(&idle_order, key);
+        g_hash_table_steal(idle_proxies, object_path);
+        g_free(key);
+        return proxy;
+    }
+
+    return dbus_g_proxy_new_for_name(dbus_conn, DBUS_COMMON_NAME_UDISKS, object_path, DBUS_INTERFACE_DBUS_PROPERTIES);
+}
+
+void proxy_pool_release(DBusGProxy *proxy)
+{
+    if (!idle_proxies)
+        idle_proxies = g_hash_table_new_full(&g_str_hash, &g_str_equal, &g_free, &g_object_unref);
+
+    // Only one proxy per object path is worth keeping
+    const char *object_path = dbus_g_proxy_get_path(proxy);
+    if (g_hash_table_lookup(idle_proxies, object_path)) {
+        g_object_unref(proxy);
+        return;
+    }
+
+    // Make room by dropping the proxy that has been idle for the longest
+    if (g_queue_get_length(&idle_order) >= PROXY_POOL_SIZE)
+        g_hash_table_remove(idle_proxies, g_queue_pop_head(&idle_order));
+
+    gchar *key = g_strdup(object_path);
+    g_queue_push_tail(&idle_order, key);
+    g_hash_table_insert(idle_proxies, key, proxy);
+}
+
+void proxy_pool_free(void)
+{
+    g_queue_clear(&idle_order);
+    if (idle_proxies) {
+        g_hash_table_destroy(idle_proxies);
+        idle_proxies = NULL;
+    }
+}
@@ -0,0 +1,19 @@
+/*
+ * This file is part of udisks-glue.
+ *
+ * © 2011 Fernando Tarlá Cardoso Lemos
+ *
+ * Refer to the LICENSE file for licensing information.
+ *
+ */
+
+#ifndef PROXY_POOL_H
+#define PROXY_POOL_H
+
+#include <dbus/dbus-glib.h>
+
+DBusGProxy *proxy_pool_acquire(const char *object_path);
+void proxy_pool_release(DBusGProxy *proxy);
+void proxy_pool_free(void);
+
+#endif
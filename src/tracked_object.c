@@ -11,15 +11,16 @@
 #include <glib.h>
 
 #include "dbus_constants.h"
-#include "globals.h"
 #include "match.h"
 #include "matches.h"
 #include "property_cache.h"
 #include "props.h"
+#include "proxy_pool.h"
 #include "tracked_object.h"
 
 struct tracked_object_ {
     tracked_object_status status;
+    gchar *object_path;
     DBusGProxy *device_proxy;
     DBusGProxy *props_proxy;
     property_cache *props_cache;
@@ -27,46 +28,57 @@ struct tracked_object_ {
     gchar *mount_point;
     match *match_obj;
     int match_obj_loaded;
+    DBusGProxyCall *refresh_call;
+    int refresh_requeued;
+    tracked_object_refresh_callback refresh_callback;
+    void *refresh_user_data;
+    DBusGProxyCall *mount_call;
+    struct {
+        int taken;
+        int is_mounted;
+        int is_media_available;
+        gchar *mount_path;
+    } snapshot;
+    unsigned int changes;
 };
 
 tracked_object *tracked_object_create(const char *object_path)
 {
     // Allocate the memory
     tracked_object *tobj = g_malloc0(sizeof(tracked_object));
+    tobj->object_path = g_strdup(object_path);
 
-    // Create the proxies
-    tobj->device_proxy = dbus_g_proxy_new_for_name(dbus_conn, DBUS_COMMON_NAME_UDISKS, object_path, DBUS_INTERFACE_UDISKS_DEVICE);
-    tobj->props_proxy = dbus_g_proxy_new_for_name(dbus_conn, DBUS_COMMON_NAME_UDISKS, object_path, DBUS_INTERFACE_DBUS_PROPERTIES);
-
-    // Get the device file
-    tobj->device_file = get_string_property(tobj->props_proxy, "DeviceFile", DBUS_INTERFACE_UDISKS_DEVICE);
-    if (!tobj->device_file) {
-        g_object_unref(tobj->device_proxy);
-        g_object_unref(tobj->props_proxy);
-        g_free(tobj);
-        return NULL;
-    }
+    // Get a properties proxy, the device proxy is only created if we mount
+    tobj->props_proxy = proxy_pool_acquire(object_path);
 
     // Create a new cache
     tobj->props_cache = property_cache_create();
 
-    // Get a weak reference to the match object
-    tobj->match_obj = matches_find_match(tobj->props_proxy, tobj->props_cache);
-    tobj->match_obj_loaded = 1;
-
+    // The device file and the match object are loaded by the first refresh
     return tobj;
 }
 
 void tracked_object_free(tracked_object *tobj)
 {
+    // Cancel any pending calls
+    if (tobj->refresh_call)
+        dbus_g_proxy_cancel_call(tobj->props_proxy, tobj->refresh_call);
+    if (tobj->mount_call)
+        dbus_g_proxy_cancel_call(tobj->device_proxy, tobj->mount_call);
+
     // Free the proxies
-    g_object_unref(tobj->device_proxy);
-    g_object_unref(tobj->props_proxy);
+    if (tobj->device_proxy)
+        g_object_unref(tobj->device_proxy);
+    proxy_pool_release(tobj->props_proxy);
 
     // Free the properties cache
     property_cache_free(tobj->props_cache);
 
-    // Free the device file
+    // Free the snapshot
+    g_free(tobj->snapshot.mount_path);
+
+    // Free the object path and the device file
+    g_free(tobj->object_path);
     g_free(tobj->device_file);
 
     // Free the mount point
@@ -76,10 +88,100 @@ void tracked_object_free(tracked_object *tobj)
     g_free(tobj);
 }
 
+static void begin_refresh(tracked_object *tobj);
+
+static void update_snapshot(tracked_object *tobj)
+{
+    int is_mounted = get_bool_property_cached(tobj->props_cache, tobj->props_proxy, BOOL_PROPERTY(DEVICE_IS_MOUNTED));
+    int is_media_available = get_bool_property_cached(tobj->props_cache, tobj->props_proxy, BOOL_PROPERTY(DEVICE_IS_MEDIA_AVAILABLE));
+    gchar **mount_paths = get_stringv_property_cached(tobj->props_cache, tobj->props_proxy, STRINGV_PROPERTY(DEVICE_MOUNT_PATHS));
+    const char *mount_path = mount_paths ? *mount_paths : NULL;
+
+    // Everything is new the first time around
+    if (!tobj->snapshot.taken) {
+        tobj->changes = TRACKED_OBJECT_CHANGE_ALL;
+        tobj->snapshot.taken = 1;
+    }
+    else {
+        tobj->changes = 0;
+        if (is_mounted != tobj->snapshot.is_mounted)
+            tobj->changes |= TRACKED_OBJECT_CHANGE_MOUNTED;
+        if (is_media_available != tobj->snapshot.is_media_available)
+            tobj->changes |= TRACKED_OBJECT_CHANGE_MEDIA_AVAILABLE;
+        if (g_strcmp0(mount_path, tobj->snapshot.mount_path))
+            tobj->changes |= TRACKED_OBJECT_CHANGE_MOUNT_PATHS;
+    }
+
+    tobj->snapshot.is_mounted = is_mounted;
+    tobj->snapshot.is_media_available = is_media_available;
+    if (tobj->changes & TRACKED_OBJECT_CHANGE_MOUNT_PATHS) {
+        g_free(tobj->snapshot.mount_path);
+        tobj->snapshot.mount_path = g_strdup(mount_path);
+    }
+}
+
+static void refresh_done(GHashTable *props, void *user_data)
+{
+    tracked_object *tobj = user_data;
+    tobj->refresh_call = NULL;
+
+    // If another refresh was requested in the meantime, this reply is stale
+    if (tobj->refresh_requeued) {
+        tobj->refresh_requeued = 0;
+        begin_refresh(tobj);
+        return;
+    }
+
+    int success = 0;
+    if (props) {
+        property_cache_load(tobj->props_cache, props);
+
+        // Load the device file and the match object on the first refresh
+        if (!tobj->device_file) {
+            tobj->device_file = g_strdup(get_string_property_cached(tobj->props_cache, tobj->props_proxy, STRING_PROPERTY(DEVICE_FILE)));
+            if (tobj->device_file) {
+                tobj->match_obj = matches_find_match(tobj->props_proxy, tobj->props_cache);
+                tobj->match_obj_loaded = 1;
+            }
+        }
+        success = tobj->device_file ? 1 : 0;
+
+        // Find out which of the properties we care about have changed
+        if (success)
+            update_snapshot(tobj);
+    }
+
+    // The callback might free the tracked object
+    tracked_object_refresh_callback callback = tobj->refresh_callback;
+    void *callback_user_data = tobj->refresh_user_data;
+    tobj->refresh_callback = NULL;
+    tobj->refresh_user_data = NULL;
+    callback(tobj, success, callback_user_data);
+}
+
+static void begin_refresh(tracked_object *tobj)
+{
+    tobj->refresh_call = get_all_properties_async(tobj->props_proxy, DBUS_INTERFACE_UDISKS_DEVICE, &refresh_done, tobj);
+}
+
+void tracked_object_refresh(tracked_object *tobj, tracked_object_refresh_callback callback, void *user_data)
+{
+    // If a refresh is already in flight, its callback hasn't run yet, so keep
+    // it and simply make sure the callback sees the latest properties
+    if (tobj->refresh_call) {
+        tobj->refresh_requeued = 1;
+        return;
+    }
+
+    tobj->refresh_callback = callback;
+    tobj->refresh_user_data = user_data;
+    begin_refresh(tobj);
+}
+
 void tracked_object_purge_cache(tracked_object *tobj)
 {
-    // Purge the properties cache
-    property_cache_purge(tobj->props_cache);
+    // Purge the properties describing the media, the drive hasn't changed
+    property_cache_purge_media(tobj->props_cache);
 
     // Get rid of the mount point
     if (tobj->mount_point) {
@@ -102,6 +204,16 @@ void tracked_object_set_status(tracked_object *tobj, tracked_object_status statu
     tobj->status = status;
 }
 
+unsigned int tracked_object_get_changes(tracked_object *tobj)
+{
+    return tobj->changes;
+}
+
+const char *tracked_object_get_object_path(tracked_object *tobj)
+{
+    return tobj->object_path;
+}
+
 gchar *tracked_object_get_device_file(tracked_object *tobj)
 {
     return tobj->device_file;
@@ -112,33 +224,28 @@ gchar *tracked_object_get_mount_point(tracked_object *tobj)
     if (tobj->mount_point)
         return tobj->mount_point;
 
-    gchar **mount_paths = get_stringv_property(tobj->props_proxy, "DeviceMountPaths", DBUS_INTERFACE_UDISKS_DEVICE);
-    if (!mount_paths)
+    // The mount paths are kept up to date by the refreshes
+    gchar **mount_paths = get_stringv_property_cached(tobj->props_cache, tobj->props_proxy, STRINGV_PROPERTY(DEVICE_MOUNT_PATHS));
+    if (!mount_paths || !*mount_paths)
         return NULL;
 
-    if (!*mount_paths) {
-        g_strfreev(mount_paths);
-        return NULL;
-    }
-
     tobj->mount_point = g_strdup(*mount_paths);
     return tobj->mount_point;
 }
 
-int tracked_object_get_bool_property(tracked_object *tobj, const char *name, int cached)
+property_cache *tracked_object_get_property_cache(tracked_object *tobj)
 {
-    if (cached)
-        return get_bool_property_cached(tobj->props_cache, tobj->props_proxy, name, DBUS_INTERFACE_UDISKS_DEVICE);
-    else
-        return get_bool_property(tobj->props_proxy, name, DBUS_INTERFACE_UDISKS_DEVICE);
+    return tobj->props_cache;
 }
 
-gchar *tracked_object_get_string_property(tracked_object *tobj, const char *name, int cached)
+int tracked_object_get_bool_property(tracked_object *tobj, bool_property property)
 {
-    if (cached)
-        return get_string_property_cached(tobj->props_cache, tobj->props_proxy, name, DBUS_INTERFACE_UDISKS_DEVICE);
-    else
-        return get_string_property(tobj->props_proxy, name, DBUS_INTERFACE_UDISKS_DEVICE);
+    return get_bool_property_cached(tobj->props_cache, tobj->props_proxy, property);
+}
+
+gchar *tracked_object_get_string_property(tracked_object *tobj, string_property property)
+{
+    return get_string_property_cached(tobj->props_cache, tobj->props_proxy, property);
 }
 
 #define LOAD_MATCH_OBJ \
@@ -151,47 +258,44 @@ gchar *tracked_object_get_string_property(tracked_object *tobj, const char *name
             return NULL; \
     } while (0)
 
-const char *tracked_object_get_post_insertion_command(tracked_object *tobj)
+command *tracked_object_get_post_insertion_command(tracked_object *tobj)
 {
     LOAD_MATCH_OBJ;
     return match_get_post_insertion_command(tobj->match_obj);
 }
 
-const char *tracked_object_get_post_mount_command(tracked_object *tobj)
+command *tracked_object_get_post_mount_command(tracked_object *tobj)
 {
     LOAD_MATCH_OBJ;
     return match_get_post_mount_command(tobj->match_obj);
 }
 
-const char *tracked_object_get_post_unmount_command(tracked_object *tobj)
+command *tracked_object_get_post_unmount_command(tracked_object *tobj)
 {
     LOAD_MATCH_OBJ;
     return match_get_post_unmount_command(tobj->match_obj);
 }
 
-const char *tracked_object_get_post_removal_command(tracked_object *tobj)
+command *tracked_object_get_post_removal_command(tracked_object *tobj)
 {
     LOAD_MATCH_OBJ;
     return match_get_post_removal_command(tobj->match_obj);
 }
 
-void tracked_object_automount_if_needed(tracked_object *tobj)
+coprocess *tracked_object_get_coprocess(tracked_object *tobj)
 {
-    if (!tobj->match_obj_loaded) {
-        tobj->match_obj = matches_find_match(tobj->props_proxy, tobj->props_cache);
-        tobj->match_obj_loaded = 1;
-    }
-    if (!tobj->match_obj || !match_get_automount(tobj->match_obj))
-        return;
+    LOAD_MATCH_OBJ;
+    return match_get_coprocess(tobj->match_obj);
+}
 
-    g_print("Trying to automount %s...\n", tobj->device_file);
+static void automount_notify(DBusGProxy *proxy, DBusGProxyCall *call_id, void *user_data)
+{
+    tracked_object *tobj = user_data;
+    tobj->mount_call = NULL;
 
     GError *error = NULL;
     gchar *mount_point = NULL;
-    gboolean res = dbus_g_proxy_call(tobj->device_proxy, "FilesystemMount", &error,
-            G_TYPE_STRING, match_get_automount_filesystem(tobj->match_obj),
-            G_TYPE_STRV, match_get_automount_options(tobj->match_obj),
-            G_TYPE_INVALID,
+    gboolean res = dbus_g_proxy_end_call(proxy, call_id, &error,
             G_TYPE_STRING, &mount_point,
             G_TYPE_INVALID);
 
@@ -211,3 +315,30 @@ void tracked_object_automount_if_needed(tracked_object *tobj)
         g_error_free(error);
     }
 }
+
+void tracked_object_automount_if_needed(tracked_object *tobj)
+{
+    if (!tobj->match_obj_loaded) {
+        tobj->match_obj = matches_find_match(tobj->props_proxy, tobj->props_cache);
+        tobj->match_obj_loaded = 1;
+    }
+    if (!tobj->match_obj || !match_get_automount(tobj->match_obj))
+        return;
+
+    // Don't try again while udisks is still working on it
+    if (tobj->mount_call)
+        return;
+
+    g_print("Trying to automount %s...\n", tobj->device_file);
+
+    // Share the name owner tracking of the properties proxy
+    if (!tobj->device_proxy)
+        tobj->device_proxy = dbus_g_proxy_new_from_proxy(tobj->props_proxy, DBUS_INTERFACE_UDISKS_DEVICE, NULL);
+
+    // The mount itself is reported by a DeviceChanged signal, the reply
+    // only tells us whether it worked
+    tobj->mount_call = dbus_g_proxy_begin_call(tobj->device_proxy, "FilesystemMount", &automount_notify, tobj, NULL,
+            G_TYPE_STRING, match_get_automount_filesystem(tobj->match_obj),
+            G_TYPE_STRV, match_get_automount_options(tobj->match_obj),
+            G_TYPE_INVALID);
+}
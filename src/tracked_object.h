@@ -13,32 +13,52 @@
 #include <dbus/dbus-glib.h>
 #include <glib.h>
 
+#include "command.h"
+#include "coprocess.h"
+#include "property_cache.h"
+
 typedef enum {
     TRACKED_OBJECT_STATUS_NO_MEDIA = 0,
     TRACKED_OBJECT_STATUS_INSERTED,
     TRACKED_OBJECT_STATUS_MOUNTED
 } tracked_object_status;
 
+typedef enum {
+    TRACKED_OBJECT_CHANGE_MOUNTED = 1 << 0,
+    TRACKED_OBJECT_CHANGE_MEDIA_AVAILABLE = 1 << 1,
+    TRACKED_OBJECT_CHANGE_MOUNT_PATHS = 1 << 2
+} tracked_object_change;
+
+#define TRACKED_OBJECT_CHANGE_ALL \
+    (TRACKED_OBJECT_CHANGE_MOUNTED | TRACKED_OBJECT_CHANGE_MEDIA_AVAILABLE | TRACKED_OBJECT_CHANGE_MOUNT_PATHS)
+
 typedef struct tracked_object_ tracked_object;
+typedef void (*tracked_object_refresh_callback)(tracked_object *tobj, int success, void *user_data);
 
 tracked_object *tracked_object_create(const char *object_path);
 void tracked_object_free(tracked_object *tobj);
 
+void tracked_object_refresh(tracked_object *tobj, tracked_object_refresh_callback callback, void *user_data);
+unsigned int tracked_object_get_changes(tracked_object *tobj);
+
 void tracked_object_purge_cache(tracked_object *tobj);
 
 tracked_object_status tracked_object_get_status(tracked_object *tobj);
 void tracked_object_set_status(tracked_object *tobj, tracked_object_status status);
 
+const char *tracked_object_get_object_path(tracked_object *tobj);
 gchar *tracked_object_get_device_file(tracked_object *tobj);
 gchar *tracked_object_get_mount_point(tracked_object *tobj);
 
-int tracked_object_get_bool_property(tracked_object *tobj, const char *name, int cached);
-gchar *tracked_object_get_string_property(tracked_object *tobj, const char *name, int cached);
+property_cache *tracked_object_get_property_cache(tracked_object *tobj);
+int tracked_object_get_bool_property(tracked_object *tobj, bool_property property);
+gchar *tracked_object_get_string_property(tracked_object *tobj, string_property property);
 
-const char *tracked_object_get_post_insertion_command(tracked_object *tobj);
-const char *tracked_object_get_post_mount_command(tracked_object *tobj);
-const char *tracked_object_get_post_unmount_command(tracked_object *tobj);
-const char *tracked_object_get_post_removal_command(tracked_object *tobj);
+command *tracked_object_get_post_insertion_command(tracked_object *tobj);
+command *tracked_object_get_post_mount_command(tracked_object *tobj);
+command *tracked_object_get_post_unmount_command(tracked_object *tobj);
+command *tracked_object_get_post_removal_command(tracked_object *tobj);
+coprocess *tracked_object_get_coprocess(tracked_object *tobj);
 
 void tracked_object_automount_if_needed(tracked_object *tobj);
 
@@ -0,0 +1,52 @@
+/*
+ * This file is part of udisks-glue.
+ *
+ * © 2011 Fernando Tarlá Cardoso Lemos
+ *
+ * Refer to the LICENSE file for licensing information.
+ *
+ */
+
+#ifndef UDISKS_GLUE_PLUGIN_H
+#define UDISKS_GLUE_PLUGIN_H
+
+#include <stdint.h>
+
+#define UDISKS_GLUE_PLUGIN_API_VERSION 1
+
+// Describes the device an event is about. The property accessors take udisks
+// property names (such as "IdLabel") and only look at the properties udisks-glue
+// has already loaded, they never block. Nothing here outlives the callback.
+typedef struct udisks_glue_event_ udisks_glue_event;
+struct udisks_glue_event_ {
+    const char *object_path;
+    const char *device_file;
+    const char *mount_point;
+
+    // These return 0 if the property isn't known or has another type
+    int (*get_bool)(const udisks_glue_event *event, const char *name, int *value);
+    int (*get_uint32)(const udisks_glue_event *event, const char *name, uint32_t *value);
+    int (*get_string)(const udisks_glue_event *event, const char *name, const char **value);
+    int (*get_stringv)(const udisks_glue_event *event, const char *name, const char * const **value);
+
+    void *priv;
+};
+
+typedef void (*udisks_glue_event_callback)(const udisks_glue_event *event, void *data);
+
+// Callbacks are run from the main loop, so they should return quickly
+typedef struct {
+    int api_version;
+    udisks_glue_event_callback insertion;
+    udisks_glue_event_callback mount;
+    udisks_glue_event_callback unmount;
+    udisks_glue_event_callback removal;
+    void (*unload)(void *data);
+    void *data;
+} udisks_glue_plugin;
+
+// Plugins export this function. api_version is set by udisks-glue before it's
+// called; the plugin fills in its callbacks and returns nonzero on success.
+int udisks_glue_plugin_init(udisks_glue_plugin *plugin);
+
+#endif
@@ -10,7 +10,6 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
 #include <fcntl.h>
 #include <glib.h>
 #include <glob.h>
@@ -19,36 +18,6 @@
 #include <string.h>
 #include <unistd.h>
 
-gchar *str_replace(gchar *string, gchar *search, gchar *replacement)
-{
-    gchar *str;
-    gchar **arr = g_strsplit(string, search, -1);
-    if (arr != NULL && arr[0] != NULL)
-        str = g_strjoinv(replacement, arr);
-    else
-        str = g_strdup(string);
-
-    g_strfreev(arr);
-    return str;
-}
-
-void run_command(const char *command)
-{
-    if (fork() == 0) {
-        if (fork() == 0) {
-            static const char *shell = NULL;
-            if (!shell) {
-                shell = getenv("SHELL");
-                if (!shell)
-                    shell = "/bin/sh";
-            }
-            execl(shell, shell, "-c", command, NULL);
-        }
-        exit(0);
-    }
-    wait(NULL);
-}
-
 void daemonize(void)
 {
     pid_t pid;
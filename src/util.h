@@ -13,8 +13,6 @@
 
 #include <glib.h>
 
-gchar *str_replace(gchar *string, gchar *search, gchar *replacement);
-void run_command(const char *command);
 void daemonize(void);
 void close_descriptors(void);
 const char *find_config_file(void);